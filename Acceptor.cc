@@ -1,11 +1,16 @@
 #include "Acceptor.h"
 #include "Logger.h"
 #include "InetAddress.h"
+#include "EventLoop.h"
 
 #include <sys/types.h>    
 #include <sys/socket.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+// 每次listen fd可读最多accept这么多个连接，剩下的下一轮再取，不让accept风暴饿死同一个loop上的其它连接
+static const int kMaxAcceptsPerRead = 32;
 
 
 static int createNonblocking()
@@ -15,6 +20,7 @@ static int createNonblocking()
     {
         LOG_FATAL("%s:%s:%d listen socket create err:%d \n", __FILE__, __FUNCTION__, __LINE__, errno);
     }
+    return sockfd;
 }
 
 Acceptor::Acceptor(EventLoop *loop, const InetAddress &listenAddr, bool reuseport)
@@ -22,9 +28,10 @@ Acceptor::Acceptor(EventLoop *loop, const InetAddress &listenAddr, bool reusepor
     , acceptSocket_(createNonblocking()) // socket
     , acceptChannel_(loop, acceptSocket_.fd())
     , listenning_(false)
+    , idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
 {
     acceptSocket_.setReuseAddr(true);
-    acceptSocket_.setReusePort(true);
+    acceptSocket_.setReusePort(reuseport);
     acceptSocket_.bindAddress(listenAddr); // bind
     // TcpServer::start() Acceptor.listen  有新用户的连接，要执行一个回调（connfd=》channel=》subloop）
     // baseLoop => acceptChannel_(listenfd) => 
@@ -35,37 +42,62 @@ Acceptor::~Acceptor()
 {
     acceptChannel_.disableAll();
     acceptChannel_.remove();
+    ::close(idleFd_);
 }
 
+// 可以在任意线程调用：listen立即生效（SO_REUSEPORT组里socket的顺序就是listen的顺序），channel在所属的loop里注册
 void Acceptor::listen()
 {
     listenning_ = true;
     acceptSocket_.listen(); // listen
-    acceptChannel_.enableReading(); // acceptChannel_ => Poller
+    loop_->runInLoop(std::bind(&Channel::enableReading, &acceptChannel_)); // acceptChannel_ => Poller
 }
 
 // listenfd有事件发生了，就是有新用户连接了
 void Acceptor::handleRead()
 {
-    InetAddress peerAddr;
-    int connfd = acceptSocket_.accept(&peerAddr);
-    if (connfd >= 0)
+    int connfds[kMaxAcceptsPerRead];
+    InetAddress peerAddrs[kMaxAcceptsPerRead];
+    int savedErrno = 0;
+    int n = acceptSocket_.acceptBatch(connfds, peerAddrs, kMaxAcceptsPerRead, &savedErrno);
+    for (int i = 0; i < n; ++i)
     {
         if (newConnectionCallback_)
         {
-            newConnectionCallback_(connfd, peerAddr); // 轮询找到subLoop，唤醒，分发当前的新客户端的Channel
+            newConnectionCallback_(connfds[i], peerAddrs[i]); // 轮询找到subLoop，唤醒，分发当前的新客户端的Channel
         }
         else
         {
-            ::close(connfd);
+            ::close(connfds[i]);
         }
     }
-    else
+
+    if (savedErrno != 0 && savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)
     {
-        LOG_ERROR("%s:%s:%d accept err:%d \n", __FILE__, __FUNCTION__, __LINE__, errno);
-        if (errno == EMFILE)
+        LOG_ERROR("%s:%s:%d accept err:%d \n", __FILE__, __FUNCTION__, __LINE__, savedErrno);
+        if (savedErrno == EMFILE || savedErrno == ENFILE)
         {
             LOG_ERROR("%s:%s:%d sockfd reached limit! \n", __FILE__, __FUNCTION__, __LINE__);
+            shedConnections(kMaxAcceptsPerRead - n);
+        }
+    }
+}
+
+// fd用光了，新连接留在队列里listen fd会一直可读，loop空转   腾出预留的fd把连接accept下来直接关掉，对端能及时知道被拒绝
+void Acceptor::shedConnections(int maxCount)
+{
+    for (int i = 0; i < maxCount; ++i)
+    {
+        ::close(idleFd_);
+        int connfd = ::accept(acceptSocket_.fd(), nullptr, nullptr);
+        if (connfd >= 0)
+        {
+            ::close(connfd);
+        }
+        idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (connfd < 0) // 队列取空了，或者腾出来的fd被别的线程抢走了
+        {
+            break;
         }
     }
 }
\ No newline at end of file
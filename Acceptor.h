@@ -22,12 +22,17 @@ public:
 
     bool listenning() const { return listenning_; }
     void listen();
+
+    // SO_REUSEPORT组里按cpu分发新连接，cpuToIndex[cpu]是这个cpu对应的socket在组里的下标
+    void setCpuSteering(const std::vector<int> &cpuToIndex) { acceptSocket_.setReusePortCpuSteering(cpuToIndex); }
 private:
     void handleRead();
+    void shedConnections(int maxCount);
     
-    EventLoop *loop_; // Acceptor用的就是用户定义的那个baseLoop，也称作mainLoop
+    EventLoop *loop_; // Acceptor用的就是用户定义的那个baseLoop，也称作mainLoop   分片accept时是各个subloop
     Socket acceptSocket_;
     Channel acceptChannel_;
     NewConnectionCallback newConnectionCallback_;
     bool listenning_;
+    int idleFd_; // 预留的一个fd，fd用光的时候腾出来accept并关掉新连接
 };
\ No newline at end of file
@@ -3,6 +3,372 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+
+namespace
+{
+
+// 每个线程缓存一些空闲的块，连接的发送缓冲区反复发空、再写满的时候不用每次都malloc/free
+const size_t kMaxCachedChunks = 64;
+
+struct ChunkCache
+{
+    ~ChunkCache();
+    std::vector<char*> chunks;
+};
+
+thread_local ChunkCache t_chunkCache;
+thread_local bool t_chunkCacheDestroyed = false; // 线程退出以后还在释放的Buffer直接delete
+
+ChunkCache::~ChunkCache()
+{
+    for (char *chunk : chunks)
+    {
+        delete[] chunk;
+    }
+    t_chunkCacheDestroyed = true;
+}
+
+char* allocChunk()
+{
+    if (!t_chunkCacheDestroyed && !t_chunkCache.chunks.empty())
+    {
+        char *chunk = t_chunkCache.chunks.back();
+        t_chunkCache.chunks.pop_back();
+        return chunk;
+    }
+    return new char[Buffer::kChunkSize];
+}
+
+void freeChunk(char *chunk)
+{
+    if (!t_chunkCacheDestroyed && t_chunkCache.chunks.size() < kMaxCachedChunks)
+    {
+        t_chunkCache.chunks.push_back(chunk);
+    }
+    else
+    {
+        delete[] chunk;
+    }
+}
+
+// writev一次最多发送的块数
+const int kMaxIovecs = 64 < IOV_MAX ? 64 : IOV_MAX;
+
+/**
+ * 每个线程（也就是每个loop）一块64K的读缓冲区，readv读不下的部分先落到这里，再追加到Buffer里
+ * 不清零，也不占用各个连接的内存
+ * 另外缓存一些连续模式下还回来的底层内存，空闲连接的接收缓冲区读空以后可以还回来
+ */
+const size_t kReadArenaSize = 65536;
+const size_t kMaxCachedStorages = 64;
+const size_t kMaxCachedCapacity = Buffer::kCheapPrepend + 64 * 1024; // 太大的直接释放
+
+// readFd按EWMA预留的空间上限，FIONREAD看到的更多也只预留这么多
+const size_t kMaxReadReserve = 1024 * 1024;
+// 容量超过这么大，并且是实际需要的kShrinkRatio倍以上，release的时候就缩小
+const size_t kShrinkThreshold = 64 * 1024;
+const size_t kShrinkRatio = 4;
+
+struct ReadArena
+{
+    ReadArena() : data(new char[kReadArenaSize]) {}
+    ~ReadArena();
+
+    char *data;
+    std::vector<std::vector<char>> storages;
+};
+
+thread_local ReadArena t_readArena;
+thread_local bool t_readArenaDestroyed = false;
+
+ReadArena::~ReadArena()
+{
+    delete[] data;
+    t_readArenaDestroyed = true;
+}
+
+}
+
+Buffer::Buffer(const Buffer &rhs)
+    : buffer_(rhs.buffer_)
+    , readerIndex_(rhs.readerIndex_)
+    , writerIndex_(rhs.writerIndex_)
+    , segmented_(rhs.segmented_)
+    , chunkReadIndex_(0)
+    , segmentedBytes_(0)
+    , readSizeEwma_(rhs.readSizeEwma_)
+    , probeReadSize_(rhs.probeReadSize_)
+{
+    for (size_t i = 0; i < rhs.chunks_.size(); ++i)
+    {
+        const Segment &seg = rhs.chunks_[i];
+        if (seg.slice)
+        {
+            appendSlice(seg.slice, seg.data - seg.slice->data() + rhs.chunkBegin(i));
+        }
+        else
+        {
+            appendChunks(seg.data + rhs.chunkBegin(i), rhs.chunkEnd(i) - rhs.chunkBegin(i));
+        }
+    }
+}
+
+Buffer::Buffer(Buffer &&rhs)
+    : buffer_(std::move(rhs.buffer_))
+    , readerIndex_(rhs.readerIndex_)
+    , writerIndex_(rhs.writerIndex_)
+    , segmented_(rhs.segmented_)
+    , chunks_(std::move(rhs.chunks_))
+    , chunkReadIndex_(rhs.chunkReadIndex_)
+    , segmentedBytes_(rhs.segmentedBytes_)
+    , readSizeEwma_(rhs.readSizeEwma_)
+    , probeReadSize_(rhs.probeReadSize_)
+{
+    // rhs回到Buffer(0)的状态：没有内存，下次写入的时候再分配
+    rhs.readerIndex_ = rhs.writerIndex_ = 0;
+    rhs.chunks_.clear();
+    rhs.chunkReadIndex_ = 0;
+    rhs.segmentedBytes_ = 0;
+}
+
+void Buffer::swap(Buffer &rhs)
+{
+    buffer_.swap(rhs.buffer_);
+    std::swap(readerIndex_, rhs.readerIndex_);
+    std::swap(writerIndex_, rhs.writerIndex_);
+    std::swap(segmented_, rhs.segmented_);
+    chunks_.swap(rhs.chunks_);
+    std::swap(chunkReadIndex_, rhs.chunkReadIndex_);
+    std::swap(segmentedBytes_, rhs.segmentedBytes_);
+    std::swap(readSizeEwma_, rhs.readSizeEwma_);
+    std::swap(probeReadSize_, rhs.probeReadSize_);
+}
+
+void Buffer::setSegmented(bool on)
+{
+    if (on == segmented_)
+    {
+        return;
+    }
+    std::string data = retrieveAllAsString();
+    segmented_ = on;
+    std::vector<char>().swap(buffer_); // 连续模式下写入的时候再分配
+    readerIndex_ = writerIndex_ = 0;
+    append(data.data(), data.size());
+}
+
+void Buffer::release()
+{
+    if (segmented_ || buffer_.empty())
+    {
+        return;
+    }
+    const size_t readable = readableBytes();
+    if (readable > 0)
+    {
+        // 留下剩余的数据和两次读的空间，EWMA会在突发过去以后慢慢降下来
+        size_t need = readable + 2 * readSizeEwma_;
+        need = kCheapPrepend + (need > kInitialSize ? need : kInitialSize);
+        if (buffer_.capacity() > kShrinkThreshold && buffer_.capacity() > kShrinkRatio * need)
+        {
+            std::vector<char> smaller(need);
+            std::copy(peek(), peek() + readable, smaller.begin() + kCheapPrepend);
+            buffer_.swap(smaller);
+            readerIndex_ = kCheapPrepend;
+            writerIndex_ = kCheapPrepend + readable;
+        }
+        return;
+    }
+
+    if (!t_readArenaDestroyed
+        && t_readArena.storages.size() < kMaxCachedStorages
+        && buffer_.capacity() <= kMaxCachedCapacity)
+    {
+        t_readArena.storages.emplace_back();
+        t_readArena.storages.back().swap(buffer_);
+    }
+    else
+    {
+        std::vector<char>().swap(buffer_);
+    }
+    readerIndex_ = writerIndex_ = 0;
+}
+
+void Buffer::acquire(size_t len)
+{
+    if (!t_readArenaDestroyed && !t_readArena.storages.empty())
+    {
+        buffer_.swap(t_readArena.storages.back());
+        t_readArena.storages.pop_back();
+    }
+    buffer_.resize(kCheapPrepend + (len > kInitialSize ? len : kInitialSize));
+    readerIndex_ = writerIndex_ = kCheapPrepend;
+}
+
+void Buffer::appendChunks(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        // 最后一段是slice或者写满了，新开一块
+        if (chunks_.empty() || chunks_.back().block == nullptr || chunks_.back().size == kChunkSize)
+        {
+            if (chunks_.empty())
+            {
+                chunkReadIndex_ = 0;
+            }
+            chunks_.push_back(Segment(allocChunk()));
+        }
+        Segment &back = chunks_.back();
+        size_t n = std::min(len, kChunkSize - back.size);
+        std::copy(data, data + n, back.block + back.size);
+        back.size += n;
+        segmentedBytes_ += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void Buffer::appendSlice(const Slice &slice, size_t offset)
+{
+    if (offset >= slice->size())
+    {
+        return;
+    }
+    size_t len = slice->size() - offset;
+    if (!segmented_ || len < kMinSharedSlice)
+    {
+        append(slice->data() + offset, len);
+        return;
+    }
+    if (chunks_.empty())
+    {
+        chunkReadIndex_ = 0;
+    }
+    chunks_.push_back(Segment(slice, offset));
+    segmentedBytes_ += len;
+}
+
+void Buffer::splice(Buffer *rhs)
+{
+    if (rhs == this || rhs->readableBytes() == 0)
+    {
+        return;
+    }
+    if (!rhs->segmented_)
+    {
+        append(rhs->peek(), rhs->readableBytes());
+    }
+    else if (!segmented_)
+    {
+        for (size_t i = 0; i < rhs->chunks_.size(); ++i)
+        {
+            append(rhs->chunks_[i].data + rhs->chunkBegin(i), rhs->chunkEnd(i) - rhs->chunkBegin(i));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < rhs->chunks_.size(); ++i)
+        {
+            Segment &seg = rhs->chunks_[i];
+            if (i == 0 && rhs->chunkReadIndex_ > 0)
+            {
+                // 读了一半的第一段：slice挂引用，自己的块只拷贝剩下的部分（块的写位置是按块头算的，不能直接挪）
+                if (seg.slice)
+                {
+                    appendSlice(seg.slice, seg.data - seg.slice->data() + rhs->chunkReadIndex_);
+                }
+                else
+                {
+                    appendChunks(seg.data + rhs->chunkReadIndex_, seg.size - rhs->chunkReadIndex_);
+                }
+                continue;
+            }
+            if (chunks_.empty())
+            {
+                chunkReadIndex_ = 0;
+            }
+            segmentedBytes_ += seg.size;
+            chunks_.push_back(std::move(seg));
+            seg.block = nullptr; // 块归this了
+        }
+    }
+    rhs->retrieveAll();
+}
+
+int Buffer::peekSegments(struct iovec *vec, int maxIovecs) const
+{
+    if (!segmented_)
+    {
+        if (readableBytes() == 0 || maxIovecs <= 0)
+        {
+            return 0;
+        }
+        vec[0].iov_base = const_cast<char*>(peek());
+        vec[0].iov_len = readableBytes();
+        return 1;
+    }
+    int iovcnt = 0;
+    for (size_t i = 0; i < chunks_.size() && iovcnt < maxIovecs; ++i)
+    {
+        vec[iovcnt].iov_base = const_cast<char*>(chunks_[i].data) + chunkBegin(i);
+        vec[iovcnt].iov_len = chunkEnd(i) - chunkBegin(i);
+        ++iovcnt;
+    }
+    return iovcnt;
+}
+
+void Buffer::retrieveChunks(size_t len)
+{
+    if (len >= segmentedBytes_)
+    {
+        releaseChunks(); // 发空了就把块都还回去，空闲的连接不占块
+        return;
+    }
+    segmentedBytes_ -= len;
+    while (len > 0)
+    {
+        size_t front = chunkEnd(0) - chunkReadIndex_;
+        if (len < front)
+        {
+            chunkReadIndex_ += len;
+            break;
+        }
+        len -= front;
+        if (chunks_.front().block != nullptr)
+        {
+            freeChunk(chunks_.front().block);
+        }
+        chunks_.pop_front(); // slice的引用计数在这里减掉
+        chunkReadIndex_ = 0;
+    }
+}
+
+void Buffer::copyChunks(char *dest, size_t len) const
+{
+    for (size_t i = 0; i < chunks_.size() && len > 0; ++i)
+    {
+        size_t n = std::min(len, chunkEnd(i) - chunkBegin(i));
+        std::copy(chunks_[i].data + chunkBegin(i), chunks_[i].data + chunkBegin(i) + n, dest);
+        dest += n;
+        len -= n;
+    }
+}
+
+void Buffer::releaseChunks()
+{
+    for (Segment &seg : chunks_)
+    {
+        if (seg.block != nullptr)
+        {
+            freeChunk(seg.block);
+        }
+    }
+    chunks_.clear();
+    chunkReadIndex_ = 0;
+    segmentedBytes_ = 0;
+}
 
 /**
  * 从fd上读取数据  Poller工作在LT模式
@@ -10,18 +376,53 @@
  */ 
 ssize_t Buffer::readFd(int fd, int* saveErrno)
 {
-    char extrabuf[65536] = {0}; // 栈上的内存空间  64K
+    char *extrabuf = t_readArena.data; // loop线程的读缓冲区  64K
     
     struct iovec vec[2];
     
+    if (segmented_)
+    {
+        // 分段模式一般只用在发送缓冲区上，先读到读缓冲区再追加
+        const ssize_t n = ::read(fd, extrabuf, kReadArenaSize);
+        if (n < 0)
+        {
+            *saveErrno = errno;
+        }
+        else
+        {
+            appendChunks(extrabuf, n);
+        }
+        return n;
+    }
+
+    // 按最近的读大小估计这次能读多少，大块传输先把空间留好，直接读进Buffer，不用再从读缓冲区拷贝一次
+    size_t expected = 2 * readSizeEwma_;
+    if (probeReadSize_)
+    {
+        int available = 0;
+        if (::ioctl(fd, FIONREAD, &available) == 0 && available > 0)
+        {
+            expected = static_cast<size_t>(available);
+        }
+    }
+    if (expected > kMaxReadReserve)
+    {
+        expected = kMaxReadReserve;
+    }
+    // 读缓冲区接得住的量不预留：release过的Buffer在真正读到数据之前不从缓存里取内存，读到0或者出错也不会占着
+    if (expected > kReadArenaSize)
+    {
+        ensureWriteableBytes(expected);
+    }
+
     const size_t writable = writableBytes(); // 这是Buffer底层缓冲区剩余的可写空间大小
     vec[0].iov_base = begin() + writerIndex_;
     vec[0].iov_len = writable;
 
     vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof extrabuf;
+    vec[1].iov_len = kReadArenaSize;
     
-    const int iovcnt = (writable < sizeof extrabuf) ? 2 : 1;
+    const int iovcnt = (writable < kReadArenaSize) ? 2 : 1;
     const ssize_t n = ::readv(fd, vec, iovcnt);
     if (n < 0)
     {
@@ -36,13 +437,26 @@ ssize_t Buffer::readFd(int fd, int* saveErrno)
         writerIndex_ = buffer_.size();
         append(extrabuf, n - writable);  // writerIndex_开始写 n - writable大小的数据
     }
+    if (n > 0)
+    {
+        readSizeEwma_ = (readSizeEwma_ * 7 + n) / 8;
+    }
 
     return n;
 }
 
 ssize_t Buffer::writeFd(int fd, int* saveErrno)
 {
-    ssize_t n = ::write(fd, peek(), readableBytes());
+    ssize_t n = 0;
+    if (segmented_)
+    {
+        struct iovec vec[kMaxIovecs];
+        n = ::writev(fd, vec, peekSegments(vec, kMaxIovecs));
+    }
+    else
+    {
+        n = ::write(fd, peek(), readableBytes());
+    }
     if (n < 0)
     {
         *saveErrno = errno;
@@ -1,25 +1,73 @@
 #pragma once
 
 #include <vector>
+#include <deque>
 #include <string>
 #include <algorithm>
-
-// 网络库底层的缓冲器类型定义
+#include <memory>
+#include <sys/types.h>
+
+struct iovec;
+
+/**
+ * 网络库底层的缓冲器类型定义
+ * 默认是一整块连续的内存，可读数据挪到前面或者扩容的时候会拷贝全部待处理的数据
+ * 分段模式下数据放在一串kChunkSize大小的块里，块从线程本地的缓存里分配，append只往最后一块后面追加，
+ * retrieve只释放前面读完的块，数据量再大也不会整体拷贝，writeFd用writev一次发送多个块
+ * 分段模式下还可以appendSlice挂上共享的不可变数据，只增加引用计数，不拷贝
+ * 分段模式下peek()只返回第一个块里的数据（readableBytes是所有块的总和），不能当成一整块连续内存来读，
+ * 需要连续数据时用retrieveAsString   beginWrite/ensureWriteableBytes只对连续模式有意义
+ */
 class Buffer
 {
 public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024;
+    static const size_t kChunkSize = 16 * 1024;
+    static const size_t kMinSharedSlice = 512; // 比这小的slice直接拷贝，比多挂一段便宜
+
+    // 共享的不可变数据，比如缓存好的响应，发给很多连接的时候只增加引用计数
+    using Slice = std::shared_ptr<const std::string>;
 
+    // initialSize为0的时候先不分配内存，第一次写入的时候再从线程本地的缓存里取
     explicit Buffer(size_t initialSize = kInitialSize)
-        : buffer_(kCheapPrepend + initialSize)
-        , readerIndex_(kCheapPrepend)
-        , writerIndex_(kCheapPrepend)
+        : buffer_(initialSize > 0 ? kCheapPrepend + initialSize : 0)
+        , readerIndex_(initialSize > 0 ? kCheapPrepend : 0)
+        , writerIndex_(initialSize > 0 ? kCheapPrepend : 0)
+        , segmented_(false)
+        , chunkReadIndex_(0)
+        , segmentedBytes_(0)
+        , readSizeEwma_(kInitialSize / 2)
+        , probeReadSize_(false)
     {}
+    Buffer(const Buffer &rhs);
+    Buffer(Buffer &&rhs);
+    Buffer& operator=(Buffer rhs) { swap(rhs); return *this; }
+    ~Buffer() { releaseChunks(); }
+
+    void swap(Buffer &rhs);
+
+    // 切换连续/分段模式，已有的数据会拷贝过去
+    void setSegmented(bool on);
+    bool segmented() const { return segmented_; }
+
+    /**
+     * 连续模式下回收用不到的内存，在上层处理完一批数据以后调用
+     * 读空了就把底层内存还给线程本地的缓存，下次写入的时候再取回来
+     * 还有数据的时候，容量远大于剩下的数据和最近的读大小（比如一次大的上传过去了）就缩小
+     */
+    void release();
+
+    /**
+     * readFd按最近读大小的EWMA预留空间，大块传输的连接缓冲区会跟着变大，数据直接读进Buffer
+     * 小消息的连接只用线程本地的读缓冲区中转  probe打开以后每次读之前用FIONREAD看socket里有多少数据，多一次系统调用
+     */
+    void setProbeReadSize(bool on) { probeReadSize_ = on; }
+    size_t readSizeEwma() const { return readSizeEwma_; }
 
     size_t readableBytes() const 
     {
-        return writerIndex_ - readerIndex_;
+        return segmented_ ? segmentedBytes_ : writerIndex_ - readerIndex_;
     }
 
     size_t writableBytes() const
@@ -35,13 +83,21 @@ public:
     // 返回缓冲区中可读数据的起始地址
     const char* peek() const
     {
+        if (segmented_ && !chunks_.empty())
+        {
+            return chunks_.front().data + chunkReadIndex_;
+        }
         return begin() + readerIndex_;
     }
 
     // onMessage string <- Buffer
     void retrieve(size_t len)
     {
-        if (len < readableBytes())
+        if (segmented_)
+        {
+            retrieveChunks(len);
+        }
+        else if (len < readableBytes())
         {
             readerIndex_ += len; // 应用只读取了刻度缓冲区数据的一部分，就是len，还剩下readerIndex_ += len -> writerIndex_
         }
@@ -53,7 +109,8 @@ public:
 
     void retrieveAll()
     {
-        readerIndex_ = writerIndex_ = kCheapPrepend;
+        readerIndex_ = writerIndex_ = buffer_.empty() ? 0 : kCheapPrepend; // release以后没有内存
+        releaseChunks();
     }
 
     // 把onMessage函数上报的Buffer数据，转成string类型的数据返回
@@ -64,6 +121,13 @@ public:
 
     std::string retrieveAsString(size_t len)
     {
+        if (segmented_)
+        {
+            std::string result(len, '\0');
+            copyChunks(&*result.begin(), len);
+            retrieveChunks(len);
+            return result;
+        }
         std::string result(peek(), len);
         retrieve(len); // 上面一句把缓冲区中可读的数据，已经读取出来，这里肯定要对缓冲区进行复位操作
         return result;
@@ -81,11 +145,24 @@ public:
     // 把[data, data+len]内存上的数据，添加到writable缓冲区当中
     void append(const char *data, size_t len)
     {
+        if (segmented_)
+        {
+            appendChunks(data, len);
+            return;
+        }
         ensureWriteableBytes(len);
         std::copy(data, data+len, beginWrite());
         writerIndex_ += len;
     }
 
+    // 把slice从offset开始的数据挂在后面，分段模式下不拷贝，连续模式下拷贝
+    void appendSlice(const Slice &slice, size_t offset = 0);
+    // 把rhs的可读数据全部移到后面，rhs变空   两边都是分段模式时块和slice直接移过来，最多拷贝rhs第一块里剩下的部分
+    void splice(Buffer *rhs);
+
+    // 可读数据按段填进vec，最多maxIovecs段，返回用了几个   连续模式只有一段
+    int peekSegments(struct iovec *vec, int maxIovecs) const;
+
     char* beginWrite()
     {
         return begin() + writerIndex_;
@@ -103,16 +180,19 @@ public:
 private:
     char* begin()
     {
-        // it.operator*()
-        return &*buffer_.begin();  // vector底层数组首元素的地址，也就是数组的起始地址
+        return buffer_.data();  // vector底层数组首元素的地址，也就是数组的起始地址，release以后可能是空
     }
     const char* begin() const
     {
-        return &*buffer_.begin();
+        return buffer_.data();
     }
     void makeSpace(size_t len)
     {
-        if (writableBytes() + prependableBytes() < len + kCheapPrepend)
+        if (buffer_.empty())
+        {
+            acquire(len);
+        }
+        else if (writableBytes() + prependableBytes() < len + kCheapPrepend)
         {
             buffer_.resize(writerIndex_ + len);
         }
@@ -127,7 +207,36 @@ private:
         }
     }
 
+    void acquire(size_t len);
+    void appendChunks(const char *data, size_t len);
+    void retrieveChunks(size_t len);
+    void copyChunks(char *dest, size_t len) const;
+    void releaseChunks();
+    // 第i段里可读数据的范围
+    size_t chunkBegin(size_t i) const { return i == 0 ? chunkReadIndex_ : 0; }
+    size_t chunkEnd(size_t i) const { return chunks_[i].size; }
+
+    // 分段模式下的一段：自己的块（可以继续往后写），或者引用的一个slice（只读）
+    struct Segment
+    {
+        explicit Segment(char *b) : data(b), size(0), block(b) {}
+        Segment(const Slice &s, size_t offset) : data(s->data() + offset), size(s->size() - offset), block(nullptr), slice(s) {}
+
+        const char *data;
+        size_t size;  // 已经写入的长度
+        char *block;  // 自己的块，引用slice的时候为空
+        Slice slice;
+    };
+
     std::vector<char> buffer_;
     size_t readerIndex_;
     size_t writerIndex_;
+
+    bool segmented_;
+    std::deque<Segment> chunks_; // 分段模式下的数据段
+    size_t chunkReadIndex_;  // 第一段里的读位置
+    size_t segmentedBytes_;  // 所有块里可读数据的总长度
+
+    size_t readSizeEwma_; // 最近readFd每次读到的字节数的EWMA
+    bool probeReadSize_;
 };
\ No newline at end of file
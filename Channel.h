@@ -36,7 +36,7 @@ public:
 
     int fd() const { return fd_; }
     int events() const { return events_; }
-    int set_revents(int revt) { revents_ = revt; }
+    void set_revents(int revt) { revents_ = revt; }
 
     // 设置fd相应的事件状态
     void enableReading() { events_ |= kReadEvent; update(); }
@@ -50,11 +50,17 @@ public:
     bool isWriting() const { return events_ & kWriteEvent; }
     bool isReading() const { return events_ & kReadEvent; }
 
+    // 是否以边缘触发的方式注册到poller上，需要在enableReading之前设置
+    void setEdgeTriggered(bool on) { edgeTriggered_ = on; }
+    bool edgeTriggered() const { return edgeTriggered_; }
+
     int index() { return index_; }
     void set_index(int idx) { index_ = idx; }
 
     // one loop per thread
     EventLoop* ownerLoop() { return loop_; }
+    // 连接迁移时换到另一个loop上，只能在channel已经从原来的poller上remove掉以后调用
+    void setOwnerLoop(EventLoop *loop) { loop_ = loop; }
     void remove();
 private:
 
@@ -70,6 +76,7 @@ private:
     int events_; // 注册fd感兴趣的事件
     int revents_; // poller返回的具体发生的事件
     int index_;
+    bool edgeTriggered_;
 
     std::weak_ptr<void> tie_;
     bool tied_;
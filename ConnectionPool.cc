@@ -0,0 +1,75 @@
+#include "ConnectionPool.h"
+#include "Logger.h"
+
+#include <new>
+#include <cstddef>
+
+ConnectionPool::ConnectionPool(int index)
+    : index_(index)
+    , blockSize_(0)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (char *chunk : chunks_)
+    {
+        ::operator delete(chunk);
+    }
+}
+
+int64_t ConnectionPool::reserve()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t block;
+    if (!freeBlocks_.empty())
+    {
+        block = freeBlocks_.back();
+        freeBlocks_.pop_back();
+    }
+    else
+    {
+        if (generations_.size() >= kMaxBlocks)
+        {
+            LOG_FATAL("%s:%s:%d connection pool %d is full! \n", __FILE__, __FUNCTION__, __LINE__, index_);
+        }
+        block = static_cast<uint32_t>(generations_.size());
+        generations_.push_back(0);
+    }
+    return static_cast<int64_t>(generations_[block]) << 32 | static_cast<int64_t>(index_) << 24 | block;
+}
+
+void ConnectionPool::release(int64_t id)
+{
+    uint32_t block = static_cast<uint32_t>(id & (kMaxBlocks - 1));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generations_[block];
+    freeBlocks_.push_back(block);
+}
+
+void* ConnectionPool::blockOf(int64_t id, size_t size)
+{
+    uint32_t block = static_cast<uint32_t>(id & (kMaxBlocks - 1));
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (blockSize_ == 0)
+    {
+        // 按最大的对齐要求取整，块的起始地址都是对齐的
+        const size_t align = alignof(std::max_align_t);
+        blockSize_ = (size + align - 1) / align * align;
+    }
+    if (size > blockSize_)
+    {
+        return nullptr;
+    }
+
+    size_t chunk = block / kBlocksPerChunk;
+    if (chunks_.size() <= chunk)
+    {
+        chunks_.resize(chunk + 1, nullptr);
+    }
+    if (chunks_[chunk] == nullptr)
+    {
+        chunks_[chunk] = static_cast<char*>(::operator new(blockSize_ * kBlocksPerChunk));
+    }
+    return chunks_[chunk] + (block % kBlocksPerChunk) * blockSize_;
+}
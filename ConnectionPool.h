@@ -0,0 +1,88 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * TcpConnection的slab，每个loop一个
+ * 每个连接占一个块，TcpConnection和shared_ptr的引用计数放在同一个块里（配合ConnectionAllocator使用）
+ * 内存一次申请kBlocksPerChunk个块，释放的块挂在空闲列表上复用，不还给系统
+ *
+ * 连接id = 代数<<32 | 池子编号<<24 | 块编号   块每被释放一次代数加一
+ * 旧的id不会和复用同一个块的新连接冲突，不同池子的id也不会冲突，连接迁移到别的loop以后id不变
+ * reserve在所属loop线程中调用，release在最后一个TcpConnectionPtr释放的线程里，所以加锁
+ */
+class ConnectionPool : noncopyable
+{
+public:
+    static const int kMaxPools = 256;
+
+    explicit ConnectionPool(int index);
+    ~ConnectionPool();
+
+    // 占一个块，返回连接id
+    int64_t reserve();
+    // 归还id对应的块
+    void release(int64_t id);
+    // id对应的块的地址，size是要放进去的对象的大小，第一次调用时决定块的大小，放不下返回nullptr
+    void* blockOf(int64_t id, size_t size);
+
+    int index() const { return index_; }
+private:
+    static const int kBlocksPerChunk = 64;
+    static const uint32_t kMaxBlocks = 1 << 24;
+
+    const int index_;
+    std::mutex mutex_;
+    size_t blockSize_; // 0表示还没有决定
+    std::vector<char*> chunks_; // 按需申请，没用到的是nullptr
+    std::vector<uint32_t> generations_; // 每个块当前的代数
+    std::vector<uint32_t> freeBlocks_;
+};
+
+/**
+ * 给std::allocate_shared用的分配器，把对象和引用计数放到池子里预先reserve好的块里
+ * 控制块里保存着一份分配器，所以池子会活到最后一个连接释放以后，loop先销毁也没关系
+ */
+template <typename T>
+class ConnectionAllocator
+{
+public:
+    using value_type = T;
+
+    ConnectionAllocator(const std::shared_ptr<ConnectionPool> &pool, int64_t id)
+        : pool_(pool), id_(id) {}
+    template <typename U>
+    ConnectionAllocator(const ConnectionAllocator<U> &other)
+        : pool_(other.pool_), id_(other.id_) {}
+
+    T* allocate(size_t n)
+    {
+        void *p = n == 1 ? pool_->blockOf(id_, sizeof(T)) : nullptr;
+        return static_cast<T*>(p != nullptr ? p : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n != 1 || p != pool_->blockOf(id_, sizeof(T)))
+        {
+            ::operator delete(p);
+        }
+        pool_->release(id_);
+    }
+
+    template <typename U>
+    bool operator==(const ConnectionAllocator<U> &other) const { return pool_ == other.pool_ && id_ == other.id_; }
+    template <typename U>
+    bool operator!=(const ConnectionAllocator<U> &other) const { return !(*this == other); }
+private:
+    template <typename U> friend class ConnectionAllocator;
+
+    std::shared_ptr<ConnectionPool> pool_;
+    int64_t id_;
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+/**
+ * 基于C++20协程的连接处理接口，只有头文件，使用它的代码需要用-std=c++20编译（库本身仍然是C++11）
+ * 
+ *  co::Task session(TcpConnectionPtr conn)
+ *  {
+ *      while (auto line = co_await co::readUntil(conn, "\r\n"))
+ *      {
+ *          co_await co::write(conn, *line + "\r\n");
+ *          co_await co::sleepFor(conn, 10);
+ *      }
+ *  }
+ *  co::serve(server, session);
+ * 
+ * 所有的协程都在连接所属的subLoop线程中运行，唤醒直接在Poller回调/定时器回调里面resume，不需要额外queueInLoop
+ * 用sleepFor(conn, ms)睡眠的连接在醒来之前不会被迁移到别的loop
+ * 协程帧从每个loop线程自己的内存池里分配，挂起和恢复不会访问堆
+ * co::serve会占用TcpServer的连接/消息/写完成回调，以及TcpConnection的context
+ */ 
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "Coroutine.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "Buffer.h"
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+namespace co
+{
+
+// 协程帧的内存池，每个线程（也就是每个loop）一份，按64字节分档，超过4K的直接走operator new
+class FramePool
+{
+public:
+    static FramePool& instance()
+    {
+        static thread_local FramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size)
+    {
+        size_t cls = sizeClass(size);
+        if (cls >= kNumClasses)
+        {
+            return ::operator new(size);
+        }
+        FreeBlock *block = freeLists_[cls];
+        if (block != nullptr)
+        {
+            freeLists_[cls] = block->next;
+            return block;
+        }
+        return ::operator new((cls + 1) * kAlignment);
+    }
+
+    void deallocate(void *p, size_t size)
+    {
+        size_t cls = sizeClass(size);
+        if (cls >= kNumClasses)
+        {
+            ::operator delete(p);
+            return;
+        }
+        FreeBlock *block = static_cast<FreeBlock*>(p);
+        block->next = freeLists_[cls];
+        freeLists_[cls] = block;
+    }
+
+    ~FramePool()
+    {
+        for (FreeBlock *head : freeLists_)
+        {
+            while (head != nullptr)
+            {
+                FreeBlock *next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+private:
+    static const size_t kAlignment = 64;
+    static const size_t kNumClasses = 64;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    FramePool() : freeLists_() {}
+
+    static size_t sizeClass(size_t size) { return (size + kAlignment - 1) / kAlignment - 1; }
+
+    FreeBlock *freeLists_[kNumClasses];
+};
+
+// 连接处理协程的返回类型，创建后立即执行，结束时自动释放协程帧
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object() { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::instance().allocate(size); }
+        static void operator delete(void *p, size_t size) { FramePool::instance().deallocate(p, size); }
+    };
+};
+
+// co::serve保存在TcpConnection context里面的协程状态
+struct ConnectionState
+{
+    std::coroutine_handle<> reader; // 挂起在readUntil上的协程
+    std::string_view delimiter; // reader等待的分隔符
+    std::coroutine_handle<> writer; // 挂起在write上、等待outputBuffer发完的协程
+    bool closed = false;
+};
+
+inline ConnectionState* stateOf(const TcpConnectionPtr &conn)
+{
+    return static_cast<ConnectionState*>(conn->getContext().get());
+}
+
+inline bool hasDelimiter(Buffer *buf, std::string_view delimiter)
+{
+    const char *begin = buf->peek();
+    const char *end = begin + buf->readableBytes();
+    return std::search(begin, end, delimiter.begin(), delimiter.end()) != end;
+}
+
+inline void resume(std::coroutine_handle<> &handle)
+{
+    if (handle)
+    {
+        std::coroutine_handle<> h = handle;
+        handle = nullptr;
+        h.resume();
+    }
+}
+
+// co_await co::readUntil(conn, "\r\n")：读到分隔符为止，返回不含分隔符的一行；连接关闭返回nullopt
+class ReadUntilAwaiter
+{
+public:
+    ReadUntilAwaiter(TcpConnectionPtr conn, std::string_view delimiter)
+        : conn_(std::move(conn)), delimiter_(delimiter) {}
+
+    bool await_ready() const
+    {
+        return stateOf(conn_)->closed || hasDelimiter(conn_->inputBuffer(), delimiter_);
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        ConnectionState *state = stateOf(conn_);
+        state->reader = handle;
+        state->delimiter = delimiter_;
+    }
+
+    std::optional<std::string> await_resume()
+    {
+        Buffer *buf = conn_->inputBuffer();
+        const char *begin = buf->peek();
+        const char *end = begin + buf->readableBytes();
+        const char *found = std::search(begin, end, delimiter_.begin(), delimiter_.end());
+        if (found == end)
+        {
+            return std::nullopt; // 没有等到分隔符连接就关闭了
+        }
+        std::string line(begin, found);
+        buf->retrieve(found - begin + delimiter_.size());
+        return line;
+    }
+private:
+    TcpConnectionPtr conn_;
+    std::string_view delimiter_;
+};
+
+// co_await co::write(conn, data)：发送数据，数据全部交给内核以后返回true，连接已经关闭返回false
+class WriteAwaiter
+{
+public:
+    WriteAwaiter(TcpConnectionPtr conn, std::string_view data)
+        : conn_(std::move(conn)), data_(data) {}
+
+    bool await_ready()
+    {
+        if (!conn_->connected())
+        {
+            return true;
+        }
+        conn_->send(std::string(data_));
+        return conn_->outputBytes() == 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        stateOf(conn_)->writer = handle;
+    }
+
+    bool await_resume() const { return conn_->connected(); }
+private:
+    TcpConnectionPtr conn_;
+    std::string_view data_;
+};
+
+// co_await co::sleepFor(conn, ms)：挂起ms毫秒，必须在连接的loop线程中调用   睡眠期间连接不会被迁走，恢复时还在同一个loop上
+// co_await co::sleepFor(loop, ms)：在loop的定时器上挂起ms毫秒并在loop线程中恢复，用于和连接无关的协程
+class SleepAwaiter
+{
+public:
+    SleepAwaiter(EventLoop *loop, int milliseconds)
+        : loop_(loop), milliseconds_(milliseconds) {}
+    SleepAwaiter(TcpConnectionPtr conn, int milliseconds)
+        : loop_(conn->getLoop()), conn_(std::move(conn)), milliseconds_(milliseconds) {}
+
+    bool await_ready() const { return milliseconds_ <= 0; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        if (conn_)
+        {
+            // 定时器挂在当前loop上，期间的迁移请求推迟到醒来以后，否则会在旧loop线程里resume
+            TcpConnectionPtr conn = conn_;
+            conn->pinLoop();
+            loop_->runAfter(milliseconds_ / 1000.0, [conn, handle]() {
+                conn->unpinLoop();
+                handle.resume();
+            });
+        }
+        else
+        {
+            loop_->runAfter(milliseconds_ / 1000.0, [handle]() { handle.resume(); });
+        }
+    }
+
+    void await_resume() const {}
+private:
+    EventLoop *loop_;
+    TcpConnectionPtr conn_; // 为空表示和连接无关
+    int milliseconds_;
+};
+
+inline ReadUntilAwaiter readUntil(const TcpConnectionPtr &conn, std::string_view delimiter)
+{
+    return ReadUntilAwaiter(conn, delimiter);
+}
+
+inline WriteAwaiter write(const TcpConnectionPtr &conn, std::string_view data)
+{
+    return WriteAwaiter(conn, data);
+}
+
+inline SleepAwaiter sleepFor(EventLoop *loop, int milliseconds)
+{
+    return SleepAwaiter(loop, milliseconds);
+}
+
+inline SleepAwaiter sleepFor(const TcpConnectionPtr &conn, int milliseconds)
+{
+    return SleepAwaiter(conn, milliseconds);
+}
+
+// 每个新连接启动一个handler协程，需要在server.start()之前调用
+inline void serve(TcpServer &server, std::function<Task(TcpConnectionPtr)> handler)
+{
+    server.setConnectionCallback([handler](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            conn->setContext(std::make_shared<ConnectionState>());
+            handler(conn);
+        }
+        else if (ConnectionState *state = stateOf(conn))
+        {
+            // 连接断开，唤醒所有挂起的协程，让它们看到连接已经关闭
+            state->closed = true;
+            resume(state->reader);
+            resume(state->writer);
+        }
+    });
+
+    server.setMessageCallback([](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        ConnectionState *state = stateOf(conn);
+        if (state->reader && hasDelimiter(buf, state->delimiter))
+        {
+            resume(state->reader);
+        }
+    });
+
+    server.setWriteCompleteCallback([](const TcpConnectionPtr &conn) {
+        // 之前直接写完的send也会排队回调过来，只有outputBuffer真正发空了才唤醒
+        if (conn->outputBytes() == 0)
+        {
+            resume(stateOf(conn)->writer);
+        }
+    });
+}
+
+} // namespace co
@@ -1,5 +1,8 @@
 #include "Poller.h"
 #include "EPollPoller.h"
+#include "PollPoller.h"
+#include "IoUringPoller.h"
+#include "Logger.h"
 
 #include <stdlib.h>
 
@@ -7,10 +10,20 @@ Poller* Poller::newDefaultPoller(EventLoop *loop)
 {
     if (::getenv("MUDUO_USE_POLL"))
     {
-        return nullptr; // 生成poll的实例
+        return new PollPoller(loop); // 生成poll的实例
     }
-    else
+#ifdef MUDUO_HAVE_IO_URING
+    if (::getenv("MUDUO_USE_IOURING"))
     {
-        return new EPollPoller(loop); // 生成epoll的实例
+        IoUringPoller *poller = new IoUringPoller(loop); // 生成io_uring的实例
+        if (poller->valid())
+        {
+            return poller;
+        }
+        // 内核不支持的时候退回到epoll
+        LOG_ERROR("io_uring is not supported, fall back to epoll \n");
+        delete poller;
     }
-}
\ No newline at end of file
+#endif
+    return new EPollPoller(loop); // 生成epoll的实例
+}
@@ -31,8 +31,10 @@ EPollPoller::~EPollPoller()
 
 Timestamp EPollPoller::poll(int timeoutMs, ChannelList *activeChannels)
 {
-    // 实际上应该用LOG_DEBUG输出日志更为合理
-    LOG_INFO("func=%s => fd total count:%lu \n", __FUNCTION__, channels_.size());
+    // 每轮都会调用，忙轮询时更是非常频繁，只在调试时输出
+    LOG_DEBUG("func=%s => fd total count:%lu \n", __FUNCTION__, numChannels());
+
+    applyChanges();
 
     int numEvents = ::epoll_wait(epollfd_, &*events_.begin(), static_cast<int>(events_.size()), timeoutMs);
     int saveErrno = errno;
@@ -40,7 +42,7 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList *activeChannels)
 
     if (numEvents > 0)  
     {
-        LOG_INFO("%d events happened \n", numEvents);
+        LOG_DEBUG("%d events happened \n", numEvents);
         fillActiveChannels(numEvents, activeChannels);
         if (numEvents == events_.size())
         {
@@ -67,35 +69,30 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList *activeChannels)
  *            EventLoop  =>   poller.poll
  *     ChannelList      Poller
  *                     ChannelMap  <fd, channel*>   epollfd
+ * 
+ * updateChannel只把fd记到dirtyFds_里面，下一次epoll_wait之前由applyChanges统一epoll_ctl
+ * 一轮里面多次enableWriting/disableWriting，最终只按最后的状态调用一次（或者一次都不用）
  */ 
 void EPollPoller::updateChannel(Channel *channel)
 {
     const int index = channel->index();
-    LOG_INFO("func=%s => fd=%d events=%d index=%d \n", __FUNCTION__, channel->fd(), channel->events(), index);
+    LOG_DEBUG("func=%s => fd=%d events=%d index=%d \n", __FUNCTION__, channel->fd(), channel->events(), index);
 
-    if (index == kNew || index == kDeleted)
+    if (index == kNew)
     {
-        if (index == kNew)
-        {
-            int fd = channel->fd();
-            channels_[fd] = channel;
-        }
+        addChannelToMap(channel);
+    }
+    channel->set_index(channel->isNoneEvent() ? kDeleted : kAdded);
 
-        channel->set_index(kAdded);
-        update(EPOLL_CTL_ADD, channel);
+    size_t fd = static_cast<size_t>(channel->fd());
+    if (fd >= kernelStates_.size())
+    {
+        kernelStates_.resize(channels_.size());
     }
-    else  // channel已经在poller上注册过了
+    if (!kernelStates_[fd].dirty)
     {
-        int fd = channel->fd();
-        if (channel->isNoneEvent())
-        {
-            update(EPOLL_CTL_DEL, channel);
-            channel->set_index(kDeleted);
-        }
-        else
-        {
-            update(EPOLL_CTL_MOD, channel);
-        }
+        kernelStates_[fd].dirty = true;
+        dirtyFds_.push_back(channel->fd());
     }
 }
 
@@ -103,18 +100,64 @@ void EPollPoller::updateChannel(Channel *channel)
 void EPollPoller::removeChannel(Channel *channel) 
 {
     int fd = channel->fd();
-    channels_.erase(fd);
+    removeChannelFromMap(fd);
 
-    LOG_INFO("func=%s => fd=%d\n", __FUNCTION__, fd);
+    LOG_DEBUG("func=%s => fd=%d\n", __FUNCTION__, fd);
     
-    int index = channel->index();
-    if (index == kAdded)
+    // 删除需要立即生效：fd马上就会被close，同一个fd号可能被新连接复用
+    if (static_cast<size_t>(fd) < kernelStates_.size())
     {
-        update(EPOLL_CTL_DEL, channel);
+        if (kernelStates_[fd].registered)
+        {
+            update(EPOLL_CTL_DEL, fd, 0, channel);
+        }
+        kernelStates_[fd] = KernelState(); // dirtyFds_里面残留的fd，applyChanges时找不到channel会跳过
     }
     channel->set_index(kNew);
 }
 
+// 把本轮累积的感兴趣事件的变化同步给内核，每个fd只按最终状态调用一次epoll_ctl
+void EPollPoller::applyChanges()
+{
+    for (int fd : dirtyFds_)
+    {
+        Channel *channel = findChannel(fd);
+        if (channel == nullptr)
+        {
+            continue;
+        }
+        KernelState &state = kernelStates_[fd];
+        state.dirty = false;
+
+        uint32_t events = 0;
+        if (!channel->isNoneEvent())
+        {
+            events = channel->events();
+            if (channel->edgeTriggered())
+            {
+                events |= EPOLLET;
+            }
+        }
+
+        if (!state.registered && events != 0)
+        {
+            update(EPOLL_CTL_ADD, fd, events, channel);
+            state.registered = true;
+        }
+        else if (state.registered && events == 0)
+        {
+            update(EPOLL_CTL_DEL, fd, 0, channel);
+            state.registered = false;
+        }
+        else if (state.registered && events != state.events)
+        {
+            update(EPOLL_CTL_MOD, fd, events, channel);
+        }
+        state.events = events;
+    }
+    dirtyFds_.clear();
+}
+
 // 填写活跃的连接
 void EPollPoller::fillActiveChannels(int numEvents, ChannelList *activeChannels) const
 {
@@ -127,17 +170,15 @@ void EPollPoller::fillActiveChannels(int numEvents, ChannelList *activeChannels)
 }
 
 // 更新channel通道 epoll_ctl add/mod/del
-void EPollPoller::update(int operation, Channel *channel)
+void EPollPoller::update(int operation, int fd, uint32_t events, Channel *channel)
 {
     epoll_event event;
     bzero(&event, sizeof event);
-    
-    int fd = channel->fd();
 
-    event.events = channel->events();
-    event.data.fd = fd; 
+    event.events = events;
     event.data.ptr = channel;
-    
+
+    ctlCalls_.store(ctlCalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     if (::epoll_ctl(epollfd_, operation, fd, &event) < 0)
     {
         if (operation == EPOLL_CTL_DEL)
@@ -30,10 +30,23 @@ private:
     // 填写活跃的连接
     void fillActiveChannels(int numEvents, ChannelList *activeChannels) const;
     // 更新channel通道
-    void update(int operation, Channel *channel);
+    void update(int operation, int fd, uint32_t events, Channel *channel);
+    // epoll_wait之前，把累积的变化统一提交给内核
+    void applyChanges();
+
+    // fd在内核epoll中的实际注册状态
+    struct KernelState
+    {
+        KernelState() : registered(false), dirty(false), events(0) {}
+        bool registered;
+        bool dirty; // 已经在dirtyFds_中
+        uint32_t events;
+    };
 
     using EventList = std::vector<epoll_event>;
 
     int epollfd_;
     EventList events_;
+    std::vector<KernelState> kernelStates_; // 用fd作下标
+    std::vector<int> dirtyFds_; // 本轮感兴趣事件有变化的fd
 };
\ No newline at end of file
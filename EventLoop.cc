@@ -2,12 +2,14 @@
 #include "Logger.h"
 #include "Poller.h"
 #include "Channel.h"
+#include "TimerQueue.h"
 
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <memory>
+#include <algorithm>
 
 // 防止一个线程创建多个EventLoop   thread_local
 __thread EventLoop *t_loopInThisThread = nullptr;
@@ -31,9 +33,17 @@ EventLoop::EventLoop()
     , quit_(false)
     , callingPendingFunctors_(false)
     , threadId_(CurrentThread::tid())
+    , maxSpinUs_(0)
+    , spinBudgetUs_(0)
     , poller_(Poller::newDefaultPoller(this))
+    , timerQueue_(new TimerQueue(this))
     , wakeupFd_(createEventfd())
     , wakeupChannel_(new Channel(this, wakeupFd_))
+    , wakeupPending_(false)
+    , wakeupWrites_(0)
+    , wakeupsSuppressed_(0)
+    , activeConnections_(0)
+    , iterationLatencyUs_(0)
 {
     LOG_DEBUG("EventLoop created %p in thread %d \n", this, threadId_);
     if (t_loopInThisThread)
@@ -71,7 +81,14 @@ void EventLoop::loop()
     {
         activeChannels_.clear();
         // 监听两类fd   一种是client的fd，一种wakeupfd
-        pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+        if (maxSpinUs_ > 0)
+        {
+            pollReturnTime_ = busyPoll();
+        }
+        else
+        {
+            pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+        }
         for (Channel *channel : activeChannels_)
         {
             // Poller监听哪些channel发生事件了，然后上报给EventLoop，通知channel处理相应的事件
@@ -83,12 +100,45 @@ void EventLoop::loop()
          * mainLoop 事先注册一个回调cb（需要subloop来执行）    wakeup subloop后，执行下面的方法，执行之前mainloop注册的cb操作
          */ 
         doPendingFunctors();
+
+        // 本轮处理耗时，按 avg += (cur - avg) / 8 平滑
+        int64_t cost = Timestamp::now().microSecondsSinceEpoch() - pollReturnTime_.microSecondsSinceEpoch();
+        int64_t avg = iterationLatencyUs_.load(std::memory_order_relaxed);
+        iterationLatencyUs_.store(avg + (cost - avg) / 8, std::memory_order_relaxed);
     }
 
     LOG_INFO("EventLoop %p stop looping. \n", this);
     looping_ = false;
 }
 
+void EventLoop::setBusyPoll(int maxSpinUs)
+{
+    maxSpinUs_ = maxSpinUs > 0 ? maxSpinUs : 0;
+    spinBudgetUs_ = maxSpinUs_;
+}
+
+Timestamp EventLoop::busyPoll()
+{
+    Timestamp start(Timestamp::now());
+    while (!quit_)
+    {
+        Timestamp now(poller_->poll(0, &activeChannels_));
+        if (!activeChannels_.empty() || !pendingFunctors_.empty())
+        {
+            // 自旋等到了事件，下一次可以多自旋一会
+            spinBudgetUs_ = std::min(spinBudgetUs_ * 2, maxSpinUs_);
+            return now;
+        }
+        if (now.microSecondsSinceEpoch() - start.microSecondsSinceEpoch() >= spinBudgetUs_)
+        {
+            break;
+        }
+    }
+    // 自旋落空，说明当前比较空闲，缩短自旋时间，退回到阻塞的poll
+    spinBudgetUs_ = std::max(spinBudgetUs_ / 2, 1);
+    return poller_->poll(quit_ ? 0 : kPollTimeMs, &activeChannels_);
+}
+
 // 退出事件循环  1.loop在自己的线程中调用quit  2.在非loop的线程中，调用loop的quit
 /**
  *              mainLoop
@@ -117,16 +167,13 @@ void EventLoop::runInLoop(Functor cb)
     }
     else // 在非当前loop线程中执行cb , 就需要唤醒loop所在线程，执行cb
     {
-        queueInLoop(cb);
+        queueInLoop(std::move(cb));
     }
 }
 // 把cb放入队列中，唤醒loop所在的线程，执行cb
 void EventLoop::queueInLoop(Functor cb)
 {
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        pendingFunctors_.emplace_back(cb);
-    }
+    pendingFunctors_.push(std::move(cb));
 
     // 唤醒相应的，需要执行上面回调操作的loop的线程了
     // || callingPendingFunctors_的意思是：当前loop正在执行回调，但是loop又有了新的回调
@@ -144,11 +191,43 @@ void EventLoop::handleRead()
   {
     LOG_ERROR("EventLoop::handleRead() reads %lu bytes instead of 8", n);
   }
+  // 必须在doPendingFunctors之前清掉标志：此后入队的回调会重新写eventfd，此前入队的回调本轮就会执行
+  wakeupPending_.store(false);
+}
+
+TimerId EventLoop::runAt(Timestamp time, TimerCallback cb)
+{
+    return timerQueue_->addTimer(std::move(cb), time, 0.0);
+}
+
+TimerId EventLoop::runAfter(double delay, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), delay));
+    return runAt(time, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double interval, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), interval));
+    return timerQueue_->addTimer(std::move(cb), time, interval);
+}
+
+void EventLoop::cancel(TimerId timerId)
+{
+    timerQueue_->cancel(timerId);
 }
 
 // 用来唤醒loop所在的线程的  向wakeupfd_写一个数据，wakeupChannel就发生读事件，当前loop线程就会被唤醒
 void EventLoop::wakeup()
 {
+    if (wakeupPending_.exchange(true))
+    {
+        // eventfd已经是可读的了，loop醒来后会处理掉所有已入队的回调
+        wakeupsSuppressed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    wakeupWrites_.fetch_add(1, std::memory_order_relaxed);
+
     uint64_t one = 1;
     ssize_t n = write(wakeupFd_, &one, sizeof one);
     if (n != sizeof one)
@@ -168,6 +247,11 @@ void EventLoop::removeChannel(Channel *channel)
     poller_->removeChannel(channel);
 }
 
+uint64_t EventLoop::pollerCtlCalls() const
+{
+    return poller_->ctlCalls();
+}
+
 bool EventLoop::hasChannel(Channel *channel)
 {
     return poller_->hasChannel(channel);
@@ -175,17 +259,15 @@ bool EventLoop::hasChannel(Channel *channel)
 
 void EventLoop::doPendingFunctors() // 执行回调
 {
-    std::vector<Functor> functors;
     callingPendingFunctors_ = true;
 
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        functors.swap(pendingFunctors_);
-    }
-
-    for (const Functor &functor : functors)
+    // 只执行进来时已经在队列中的回调，回调中新加入的回调留到下一轮（queueInLoop会wakeup），避免一直不返回poll
+    size_t count = pendingFunctors_.size();
+    Functor functor;
+    while (count > 0 && pendingFunctors_.pop(&functor))
     {
         functor(); // 执行当前loop需要执行的回调操作
+        --count;
     }
 
     callingPendingFunctors_ = false;
@@ -4,14 +4,17 @@
 #include <vector>
 #include <atomic>
 #include <memory>
-#include <mutex>
 
 #include "noncopyable.h"
 #include "Timestamp.h"
 #include "CurrentThread.h"
+#include "Callbacks.h"
+#include "TimerId.h"
+#include "MpscQueue.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
 
 // 时间循环类  主要包含了两个大模块 Channel   Poller（epoll的抽象）
 class EventLoop : noncopyable
@@ -34,19 +37,49 @@ public:
     // 把cb放入队列中，唤醒loop所在的线程，执行cb
     void queueInLoop(Functor cb);
 
-    // 用来唤醒loop所在的线程的
+    // 定时器接口，线程安全   runAt在time时刻执行cb，runAfter在delay秒后执行cb，runEvery每隔interval秒执行一次cb
+    TimerId runAt(Timestamp time, TimerCallback cb);
+    TimerId runAfter(double delay, TimerCallback cb);
+    TimerId runEvery(double interval, TimerCallback cb);
+    // 取消定时器
+    void cancel(TimerId timerId);
+
+    // 用来唤醒loop所在的线程的，loop处理wakeupfd之前的多次wakeup只会写一次eventfd
     void wakeup();
+    // 实际写eventfd的次数 / 因为已经有未处理的唤醒而省掉的次数
+    uint64_t wakeupWrites() const { return wakeupWrites_.load(std::memory_order_relaxed); }
+    uint64_t wakeupsSuppressed() const { return wakeupsSuppressed_.load(std::memory_order_relaxed); }
+    // Poller调用epoll_ctl的次数
+    uint64_t pollerCtlCalls() const;
 
     // EventLoop的方法 =》 Poller的方法
     void updateChannel(Channel *channel);
     void removeChannel(Channel *channel);
     bool hasChannel(Channel *channel);
 
+    /**
+     * 忙轮询模式：阻塞在epoll_wait之前，先用0超时的poll自旋最多maxSpinUs微秒，期间有事件或者有待执行的回调就直接处理
+     * 实际的自旋预算在[1, maxSpinUs]之间，根据最近自旋是否等到了事件自适应调整  maxSpinUs<=0表示关闭
+     * 需要在loop线程中调用，或者在loop()开始之前调用（比如ThreadInitCallback里面）
+     */ 
+    void setBusyPoll(int maxSpinUs);
+    int busyPollBudgetUs() const { return spinBudgetUs_; }
+
+    /**
+     * 负载计数，给EventLoopThreadPool选择subloop用，任意线程都可以读
+     * activeConnections: 分配到这个loop上还没有销毁的连接数
+     * iterationLatencyUs: 每轮循环处理事件和回调耗时的指数加权平均（微秒）
+     */ 
+    void connectionCountAdd(int delta) { activeConnections_.fetch_add(delta, std::memory_order_relaxed); }
+    int activeConnections() const { return activeConnections_.load(std::memory_order_relaxed); }
+    int64_t iterationLatencyUs() const { return iterationLatencyUs_.load(std::memory_order_relaxed); }
+
     // 判断EventLoop对象是否在自己的线程里面
     bool isInLoopThread() const { return threadId_ ==  CurrentThread::tid(); }
 private:
     void handleRead(); // wake up
     void doPendingFunctors(); // 执行回调
+    Timestamp busyPoll(); // 先自旋，空闲时再阻塞poll
 
     using ChannelList = std::vector<Channel*>;
 
@@ -56,14 +89,22 @@ private:
     const pid_t threadId_; // 记录当前loop所在线程的id
 
     Timestamp pollReturnTime_; // poller返回发生事件的channels的时间点
+    int maxSpinUs_; // 忙轮询的最大自旋时间，0表示不自旋
+    int spinBudgetUs_; // 当前的自旋预算，命中翻倍，落空减半
     std::unique_ptr<Poller> poller_;
+    std::unique_ptr<TimerQueue> timerQueue_; // 每个loop一个定时器队列，基于timerfd
 
     int wakeupFd_; // 主要作用，当mainLoop获取一个新用户的channel，通过轮询算法选择一个subloop，通过该成员唤醒subloop处理channel
     std::unique_ptr<Channel> wakeupChannel_;
+    std::atomic_bool wakeupPending_; // 已经写过eventfd，loop还没有在handleRead中读走
+    std::atomic<uint64_t> wakeupWrites_;
+    std::atomic<uint64_t> wakeupsSuppressed_;
 
     ChannelList activeChannels_;
 
+    std::atomic<int> activeConnections_;
+    std::atomic<int64_t> iterationLatencyUs_;
+
     std::atomic_bool callingPendingFunctors_; // 标识当前loop是否有需要执行的回调操作
-    std::vector<Functor> pendingFunctors_; // 存储loop需要执行的所有的回调操作
-    std::mutex mutex_; // 互斥锁，用来保护上面vector容器的线程安全操作
+    MpscQueue<Functor> pendingFunctors_; // 存储loop需要执行的所有的回调操作，无锁的多生产者单消费者队列
 };
\ No newline at end of file
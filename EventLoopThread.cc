@@ -1,5 +1,9 @@
 #include "EventLoopThread.h"
 #include "EventLoop.h"
+#include "Logger.h"
+
+#include <pthread.h>
+#include <sched.h>
 
 
 EventLoopThread::EventLoopThread(const ThreadInitCallback &cb, 
@@ -25,9 +29,19 @@ EventLoopThread::~EventLoopThread()
 }
 
 EventLoop* EventLoopThread::startLoop()
+{
+    startThread();
+    return waitForLoop();
+}
+
+void EventLoopThread::startThread()
 {
     thread_.start(); // 启动底层的新线程
+}
 
+// 等待新线程里面的EventLoop创建好
+EventLoop* EventLoopThread::waitForLoop()
+{
     EventLoop *loop = nullptr;
     {
         std::unique_lock<std::mutex> lock(mutex_);
@@ -43,6 +57,29 @@ EventLoop* EventLoopThread::startLoop()
 // 下面这个方法，实在单独的新线程里面运行的
 void EventLoopThread::threadFunc()
 {
+    if (!cpus_.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        int count = 0;
+        for (int cpu : cpus_)
+        {
+            // CPU_SET对超出范围的编号是未定义行为
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+            {
+                LOG_ERROR("EventLoopThread invalid cpu:%d \n", cpu);
+                continue;
+            }
+            CPU_SET(cpu, &set);
+            ++count;
+        }
+        int ret = count > 0 ? ::pthread_setaffinity_np(::pthread_self(), sizeof set, &set) : 0;
+        if (ret != 0)
+        {
+            LOG_ERROR("EventLoopThread bind cpu error:%d \n", ret);
+        }
+    }
+
     EventLoop loop; // 创建一个独立的eventloop，和上面的线程是一一对应的，one loop per thread
 
     if (callback_)
@@ -7,6 +7,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <string>
+#include <vector>
 
 class EventLoop;
 
@@ -20,6 +21,14 @@ public:
     ~EventLoopThread();
 
     EventLoop* startLoop();
+    // startLoop拆成两步，先把所有线程都启动起来再逐个等待，多个loop的初始化就是并行的
+    void startThread();
+    EventLoop* waitForLoop();
+
+    // 把loop线程绑定到这些cpu上，需要在startLoop之前调用
+    // 绑定在创建EventLoop之前完成，loop的内存都在绑定的NUMA节点上首次访问
+    void setCpuAffinity(const std::vector<int> &cpus) { cpus_ = cpus; }
+    const std::vector<int>& cpuAffinity() const { return cpus_; }
 private:
     void threadFunc();
 
@@ -29,4 +38,5 @@ private:
     std::mutex mutex_;
     std::condition_variable cond_;
     ThreadInitCallback callback_;
+    std::vector<int> cpus_; // 为空表示不绑定
 };
\ No newline at end of file
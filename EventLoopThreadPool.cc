@@ -1,7 +1,124 @@
 #include "EventLoopThreadPool.h"
 #include "EventLoopThread.h"
 
+#include "Logger.h"
+#include "InetAddress.h"
+#include "EventLoop.h"
+
 #include <memory>
+#include <algorithm>
+#include <sched.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <string.h>
+
+// 进程允许运行的cpu
+static std::vector<int> availableCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof set, &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+// 解析/sys下的cpulist格式，比如 "0-3,8-11"
+static std::vector<int> parseCpuList(const char *list)
+{
+    std::vector<int> cpus;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+        {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        if (*p == ',')
+        {
+            ++p;
+        }
+    }
+    return cpus;
+}
+
+// 每个NUMA节点上进程可用的cpu，读不到节点信息时当作只有一个节点
+static std::vector<std::vector<int>> numaNodeCpus()
+{
+    std::vector<int> available = availableCpus();
+    std::vector<std::vector<int>> nodes;
+
+    DIR *dir = ::opendir("/sys/devices/system/node");
+    if (dir != nullptr)
+    {
+        std::vector<int> nodeIds;
+        while (struct dirent *entry = ::readdir(dir))
+        {
+            int id = 0;
+            if (sscanf(entry->d_name, "node%d", &id) == 1)
+            {
+                nodeIds.push_back(id);
+            }
+        }
+        ::closedir(dir);
+        std::sort(nodeIds.begin(), nodeIds.end());
+
+        for (int id : nodeIds)
+        {
+            char path[64];
+            snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", id);
+            FILE *fp = ::fopen(path, "r");
+            if (fp == nullptr)
+            {
+                continue;
+            }
+            char line[4096] = {0};
+            if (::fgets(line, sizeof line, fp) != nullptr)
+            {
+                std::vector<int> cpus;
+                for (int cpu : parseCpuList(line))
+                {
+                    if (std::find(available.begin(), available.end(), cpu) != available.end())
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty()) // 没有cpu的节点（纯内存节点）跳过
+                {
+                    nodes.push_back(cpus);
+                }
+            }
+            ::fclose(fp);
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.push_back(available);
+    }
+    return nodes;
+}
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop *baseLoop, const std::string &nameArg)
     : baseLoop_(baseLoop)
@@ -9,6 +126,9 @@ EventLoopThreadPool::EventLoopThreadPool(EventLoop *baseLoop, const std::string
     , started_(false)
     , numThreads_(0)
     , next_(0)
+    , threadsCreated_(0)
+    , affinity_(kNoAffinity)
+    , loadBalance_(kRoundRobin)
 {}
 
 EventLoopThreadPool::~EventLoopThreadPool()
@@ -17,14 +137,25 @@ EventLoopThreadPool::~EventLoopThreadPool()
 void EventLoopThreadPool::start(const ThreadInitCallback &cb)
 {
     started_ = true;
+    threadInitCallback_ = cb;
+    // /sys和sched_getaffinity只在启动的时候读一次，之后addLoop也用这份结果
+    if (affinity_ == kRoundRobinCores)
+    {
+        availableCpus_ = availableCpus();
+    }
+    else if (affinity_ == kNumaNode)
+    {
+        numaNodes_ = numaNodeCpus();
+    }
 
+    // 先把线程全部启动，再依次等待，各个loop的初始化（epoll_create、eventfd等）并行进行
     for (int i = 0; i < numThreads_; ++i)
     {
-        char buf[name_.size() + 32];
-        snprintf(buf, sizeof buf, "%s%d", name_.c_str(), i);
-        EventLoopThread *t = new EventLoopThread(cb, buf);
-        threads_.push_back(std::unique_ptr<EventLoopThread>(t));
-        loops_.push_back(t->startLoop()); // 底层创建线程，绑定一个新的EventLoop，并返回该loop的地址
+        createThread()->startThread();
+    }
+    for (auto &t : threads_)
+    {
+        loops_.push_back(t->waitForLoop()); // 等待底层线程创建好EventLoop，并返回该loop的地址
     }
 
     // 整个服务端只有一个线程，运行着baseloop
@@ -34,6 +165,102 @@ void EventLoopThreadPool::start(const ThreadInitCallback &cb)
     }
 }
 
+EventLoopThread* EventLoopThreadPool::createThread()
+{
+    char buf[name_.size() + 32];
+    snprintf(buf, sizeof buf, "%s%d", name_.c_str(), threadsCreated_);
+    EventLoopThread *t = new EventLoopThread(threadInitCallback_, buf);
+    t->setCpuAffinity(cpusForLoop(threadsCreated_));
+    ++threadsCreated_;
+    threads_.push_back(std::unique_ptr<EventLoopThread>(t));
+    return t;
+}
+
+EventLoop* EventLoopThreadPool::addLoop()
+{
+    EventLoopThread *t = createThread();
+    EventLoop *loop = t->startLoop();
+    loops_.push_back(loop);
+    return loop;
+}
+
+std::vector<int> EventLoopThreadPool::cpusOf(EventLoop *loop) const
+{
+    auto it = std::find(loops_.begin(), loops_.end(), loop);
+    if (it == loops_.end())
+    {
+        return std::vector<int>();
+    }
+    return threads_[it - loops_.begin()]->cpuAffinity(); // threads_和loops_是一一对应的
+}
+
+std::unique_ptr<EventLoopThread> EventLoopThreadPool::detachLoop(EventLoop *loop)
+{
+    std::unique_ptr<EventLoopThread> thread;
+    auto it = std::find(loops_.begin(), loops_.end(), loop);
+    if (it != loops_.end())
+    {
+        // threads_和loops_是一一对应的
+        size_t index = it - loops_.begin();
+        thread = std::move(threads_[index]);
+        threads_.erase(threads_.begin() + index);
+        loops_.erase(it);
+        if (next_ >= static_cast<int>(loops_.size()))
+        {
+            next_ = 0;
+        }
+    }
+    return thread;
+}
+
+void EventLoopThreadPool::setAffinity(AffinityPolicy policy, const std::vector<int> &cpus)
+{
+    affinity_ = policy;
+    affinityCpus_.clear();
+    for (int cpu : cpus)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            LOG_ERROR("EventLoopThreadPool::setAffinity invalid cpu:%d, skipped \n", cpu);
+            continue;
+        }
+        affinityCpus_.push_back(cpu);
+    }
+}
+
+std::vector<int> EventLoopThreadPool::cpusForLoop(int index) const
+{
+    std::vector<int> cpus;
+    switch (affinity_)
+    {
+    case kCpuList:
+        if (!affinityCpus_.empty())
+        {
+            cpus.push_back(affinityCpus_[index % affinityCpus_.size()]);
+        }
+        break;
+    case kRoundRobinCores:
+    {
+        if (!availableCpus_.empty())
+        {
+            cpus.push_back(availableCpus_[index % availableCpus_.size()]);
+        }
+        break;
+    }
+    case kNumaNode:
+    {
+        if (!numaNodes_.empty())
+        {
+            cpus = numaNodes_[index % numaNodes_.size()];
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return cpus;
+}
+
 // 如果工作在多线程中，baseLoop_默认以轮询的方式分配channel给subloop
 EventLoop* EventLoopThreadPool::getNextLoop()
 {
@@ -52,6 +279,63 @@ EventLoop* EventLoopThreadPool::getNextLoop()
     return loop;
 }
 
+EventLoop* EventLoopThreadPool::selectLoop(const InetAddress &peerAddr)
+{
+    if (loops_.empty())
+    {
+        return baseLoop_;
+    }
+
+    switch (loadBalance_)
+    {
+    case kLeastConnections:
+    {
+        EventLoop *best = loops_[0];
+        for (EventLoop *loop : loops_)
+        {
+            if (loop->activeConnections() < best->activeConnections())
+            {
+                best = loop;
+            }
+        }
+        return best;
+    }
+    case kLowestLatency:
+    {
+        // 耗时相同（比如都空闲）时按连接数区分
+        EventLoop *best = loops_[0];
+        for (EventLoop *loop : loops_)
+        {
+            if (loop->iterationLatencyUs() < best->iterationLatencyUs()
+                || (loop->iterationLatencyUs() == best->iterationLatencyUs()
+                    && loop->activeConnections() < best->activeConnections()))
+            {
+                best = loop;
+            }
+        }
+        return best;
+    }
+    case kPowerOfTwoChoices:
+    {
+        size_t n = loops_.size();
+        size_t i = random_() % n;
+        size_t j = n > 1 ? (i + 1 + random_() % (n - 1)) % n : i; // 和i不同的另一个
+        EventLoop *a = loops_[i];
+        EventLoop *b = loops_[j];
+        return b->activeConnections() < a->activeConnections() ? b : a;
+    }
+    case kPeerHash:
+    {
+        // ip是网络字节序，混一下再取模，避免同网段的客户端都落在一起
+        uint64_t h = peerAddr.getSockAddr()->sin_addr.s_addr;
+        h *= 0x9E3779B97F4A7C15ULL;
+        return loops_[(h >> 32) % loops_.size()];
+    }
+    default:
+        return getNextLoop();
+    }
+}
+
 std::vector<EventLoop*> EventLoopThreadPool::getAllLoops()
 {
     if (loops_.empty())
@@ -60,6 +344,6 @@ std::vector<EventLoop*> EventLoopThreadPool::getAllLoops()
     }
     else
     {
-        loops_;
+        return loops_;
     }
 }
\ No newline at end of file
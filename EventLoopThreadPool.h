@@ -5,9 +5,11 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <random>
 
 class EventLoop;
 class EventLoopThread;
+class InetAddress;
 
 class EventLoopThreadPool : noncopyable
 {
@@ -19,22 +21,68 @@ public:
 
     void setThreadNum(int numThreads) { numThreads_ = numThreads; }
 
+    // subloop线程的cpu绑定策略
+    enum AffinityPolicy
+    {
+        kNoAffinity,      // 不绑定，由调度器决定
+        kCpuList,         // 第i个loop绑定到cpus[i % cpus.size()]
+        kRoundRobinCores, // 第i个loop绑定到进程可用cpu中的第i个（循环）
+        kNumaNode,        // 第i个loop绑定到第i个NUMA节点（循环）的所有cpu上
+    };
+    // 需要在start之前调用，cpus只在kCpuList时使用
+    void setAffinity(AffinityPolicy policy, const std::vector<int> &cpus = std::vector<int>());
+
+    // 给新连接选择subloop的策略
+    enum LoadBalance
+    {
+        kRoundRobin,        // 轮询，默认
+        kLeastConnections,  // 活跃连接最少的loop
+        kLowestLatency,     // 最近每轮循环耗时最低的loop
+        kPowerOfTwoChoices, // 随机挑两个loop，选连接少的那个
+        kPeerHash,          // 按对端ip哈希，同一个客户端总是落在同一个loop上
+    };
+    void setLoadBalance(LoadBalance strategy) { loadBalance_ = strategy; }
+
     void start(const ThreadInitCallback &cb = ThreadInitCallback());
 
     // 如果工作在多线程中，baseLoop_默认以轮询的方式分配channel给subloop
     EventLoop* getNextLoop();
+    // 按设置的负载均衡策略给peerAddr的新连接选择一个loop，只在baseLoop_线程中调用
+    EventLoop* selectLoop(const InetAddress &peerAddr);
 
     std::vector<EventLoop*> getAllLoops();
+    // loop线程绑定的cpu，没有绑定或者loop不在池中返回空
+    std::vector<int> cpusOf(EventLoop *loop) const;
+
+    /**
+     * 运行时调整subloop的个数，都只能在baseLoop_线程中调用
+     * addLoop: 新起一个subloop线程，使用start时传入的ThreadInitCallback
+     * detachLoop: 把loop从池中摘掉，之后不会再分配新连接，返回它的线程对象，
+     *             调用方把上面的连接迁走或者关掉以后再销毁（析构时quit并join），loop不在池中返回空
+     */ 
+    EventLoop* addLoop();
+    std::unique_ptr<EventLoopThread> detachLoop(EventLoop *loop);
 
     bool started() const { return started_; }
     const std::string name() const { return name_; }
 private:
+    // 按绑定策略计算第index个loop绑定的cpu
+    std::vector<int> cpusForLoop(int index) const;
+    EventLoopThread* createThread();
 
     EventLoop *baseLoop_; // EventLoop loop;  
     std::string name_;
     bool started_;
     int numThreads_;
     int next_;
+    int threadsCreated_; // 用来给线程命名和计算cpu绑定，detach以后也不回退
+    ThreadInitCallback threadInitCallback_;
     std::vector<std::unique_ptr<EventLoopThread>> threads_;
     std::vector<EventLoop*> loops_;
+    AffinityPolicy affinity_;
+    std::vector<int> affinityCpus_;
+    std::vector<int> availableCpus_; // kRoundRobinCores用，start时读取
+    std::vector<std::vector<int>> numaNodes_; // kNumaNode用，start时读取
+    LoadBalance loadBalance_;
+    std::minstd_rand random_; // kPowerOfTwoChoices用
 };
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include "IoUringPoller.h"
+
+#ifdef MUDUO_HAVE_IO_URING
+
+#include "Logger.h"
+#include "Channel.h"
+
+#include <errno.h>
+#include <algorithm>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// 和EPollPoller一样，用channel的index_记录channel在poller中的状态
+const int kNew = -1;
+const int kAdded = 1;
+const int kDeleted = 2;
+
+// 不需要处理的完成事件（POLL_REMOVE自己的完成事件）
+const uint64_t kIgnoredUserData = UINT64_MAX;
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete,
+                              unsigned flags, void *arg, size_t argSize)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+IoUringPoller::IoUringPoller(EventLoop *loop)
+    : Poller(loop)
+    , ringFd_(-1)
+    , features_(0)
+    , sqRing_(MAP_FAILED)
+    , sqRingSize_(0)
+    , cqRing_(MAP_FAILED)
+    , cqRingSize_(0)
+    , sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , sqesSize_(0)
+    , sqLocalTail_(0)
+    , toSubmit_(0)
+    , nextGeneration_(0)
+    , round_(0)
+{
+    if (!setupRing())
+    {
+        LOG_ERROR("io_uring setup error:%d \n", errno);
+    }
+}
+
+IoUringPoller::~IoUringPoller()
+{
+    if (sqes_ != MAP_FAILED)
+    {
+        ::munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+    {
+        ::munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_ != MAP_FAILED)
+    {
+        ::munmap(sqRing_, sqRingSize_);
+    }
+    if (ringFd_ >= 0)
+    {
+        ::close(ringFd_);
+    }
+}
+
+bool IoUringPoller::setupRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    int fd = sys_io_uring_setup(kRingEntries, &params);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // poll的超时时间通过io_uring_enter的扩展参数传递，需要5.11以上的内核
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        ::close(fd);
+        errno = ENOSYS;
+        return false;
+    }
+    features_ = params.features;
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (features_ & IORING_FEAT_SINGLE_MMAP)
+    {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+    if (features_ & IORING_FEAT_SINGLE_MMAP)
+    {
+        cqRing_ = sqRing_;
+    }
+    else
+    {
+        cqRing_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    char *sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+
+    char *cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    ringFd_ = fd;
+    return true;
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList *activeChannels)
+{
+    LOG_DEBUG("func=%s => fd total count:%lu \n", __FUNCTION__, numChannels());
+
+    flushDirty();
+
+    __kernel_timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000 * 1000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+    // CQ上已经有完成事件的话就不用等了
+    bool ready = __atomic_load_n(cqHead_, __ATOMIC_RELAXED) != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    unsigned minComplete = (timeoutMs == 0 || ready) ? 0 : 1;
+
+    // 提交所有poll请求和等待完成事件，只需要这一次系统调用
+    int ret = sys_io_uring_enter(ringFd_, toSubmit_, minComplete,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg);
+    int saveErrno = errno;
+    Timestamp now(Timestamp::now());
+    if (ret >= 0)
+    {
+        toSubmit_ -= std::min(toSubmit_, static_cast<unsigned>(ret));
+    }
+    else if (saveErrno != ETIME && saveErrno != EINTR)
+    {
+        errno = saveErrno;
+        LOG_ERROR("IoUringPoller::poll() err:%d \n", saveErrno);
+    }
+
+    reapCompletions(activeChannels);
+    if (activeChannels->empty())
+    {
+        LOG_DEBUG("%s timeout! \n", __FUNCTION__);
+    }
+    return now;
+}
+
+void IoUringPoller::updateChannel(Channel *channel)
+{
+    const int index = channel->index();
+    const int fd = channel->fd();
+    LOG_DEBUG("func=%s => fd=%d events=%d index=%d \n", __FUNCTION__, fd, channel->events(), index);
+
+    if (index == kNew)
+    {
+        addChannelToMap(channel);
+        if (static_cast<size_t>(fd) >= states_.size())
+        {
+            states_.resize(channels_.size());
+        }
+    }
+    channel->set_index(channel->isNoneEvent() ? kDeleted : kAdded);
+    markDirty(fd, states_[fd]);
+}
+
+void IoUringPoller::removeChannel(Channel *channel)
+{
+    int fd = channel->fd();
+    removeChannelFromMap(fd);
+
+    LOG_DEBUG("func=%s => fd=%d\n", __FUNCTION__, fd);
+
+    if (static_cast<size_t>(fd) < states_.size())
+    {
+        // poll请求持有file的引用，close(fd)不会取消它，必须显式POLL_REMOVE
+        if (states_[fd].armed)
+        {
+            pollRemove(states_[fd].userData);
+        }
+        states_[fd] = PollState(); // dirtyFds_里面可能还有这个fd，flushDirty时找不到channel会跳过
+    }
+    channel->set_index(kNew);
+}
+
+void IoUringPoller::markDirty(int fd, PollState &state)
+{
+    if (!state.dirty)
+    {
+        state.dirty = true;
+        dirtyFds_.push_back(fd);
+    }
+}
+
+void IoUringPoller::flushDirty()
+{
+    for (int fd : dirtyFds_)
+    {
+        Channel *channel = findChannel(fd);
+        if (channel == nullptr)
+        {
+            continue;
+        }
+        PollState &state = states_[fd];
+        state.dirty = false;
+
+        int events = channel->isNoneEvent() ? 0 : channel->events();
+        if (state.armed && state.events != events)
+        {
+            pollRemove(state.userData);
+            state.armed = false;
+            state.userData = 0; // 取消之前已经产生的完成事件也一起作废
+        }
+        if (!state.armed && events != 0)
+        {
+            state.userData = (static_cast<uint64_t>(++nextGeneration_) << 32) | static_cast<uint32_t>(fd);
+            state.events = events;
+            state.armed = true;
+            pollAdd(fd, events, state.userData, channel->edgeTriggered());
+        }
+    }
+    dirtyFds_.clear();
+}
+
+io_uring_sqe* IoUringPoller::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqLocalTail_ - head >= sqEntries_)
+    {
+        // SQ满了，先把已有的请求提交给内核
+        int ret = sys_io_uring_enter(ringFd_, toSubmit_, 0, 0, nullptr, 0);
+        if (ret < 0)
+        {
+            LOG_FATAL("io_uring_enter submit error:%d \n", errno);
+        }
+        toSubmit_ -= std::min(toSubmit_, static_cast<unsigned>(ret));
+    }
+
+    unsigned index = sqLocalTail_ & sqMask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof *sqe);
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    ++toSubmit_;
+    return sqe;
+}
+
+void IoUringPoller::pollAdd(int fd, int events, uint64_t userData, bool multishot)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = static_cast<uint32_t>(events);
+    if (multishot)
+    {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = userData;
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+}
+
+void IoUringPoller::pollRemove(uint64_t userData)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = kIgnoredUserData;
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+}
+
+void IoUringPoller::reapCompletions(ChannelList *activeChannels)
+{
+    ++round_;
+    size_t first = activeChannels->size();
+    unsigned head = __atomic_load_n(cqHead_, __ATOMIC_RELAXED);
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe &cqe = cqes_[head & cqMask_];
+        if (cqe.user_data == kIgnoredUserData)
+        {
+            continue;
+        }
+        int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        if (findChannel(fd) == nullptr || states_[fd].userData != cqe.user_data)
+        {
+            continue; // 已经被取消或者替换掉的poll请求
+        }
+        PollState &state = states_[fd];
+        // multishot poll带IORING_CQE_F_MORE，表示仍然有效，不需要重新提交
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            state.armed = false;
+            if (cqe.res < 0)
+            {
+                // 出错的fd不再自动重新提交，等channel下一次updateChannel
+                if (cqe.res != -ECANCELED)
+                {
+                    LOG_ERROR("io_uring poll fd=%d err:%d \n", fd, -cqe.res);
+                }
+                continue;
+            }
+            markDirty(fd, state); // 一次性的poll，下一轮重新提交
+        }
+
+        // multishot poll一轮里面可能有同一个fd的多个完成事件，合并成一个，和epoll一样每个channel只上报一次
+        if (state.round != round_)
+        {
+            state.round = round_;
+            state.revents = cqe.res;
+            activeChannels->push_back(channels_[fd]);
+        }
+        else
+        {
+            state.revents |= cqe.res;
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+    for (size_t i = first; i < activeChannels->size(); ++i)
+    {
+        Channel *channel = (*activeChannels)[i];
+        channel->set_revents(states_[channel->fd()].revents);
+    }
+}
+
+#endif // MUDUO_HAVE_IO_URING
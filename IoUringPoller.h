@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Poller.h"
+#include "Timestamp.h"
+
+#include <vector>
+#include <stdint.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_ADD_MULTI)
+#define MUDUO_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+class Channel;
+
+#ifdef MUDUO_HAVE_IO_URING
+
+/**
+ * io_uring的使用（直接用系统调用，不依赖liburing）
+ * io_uring_setup   mmap SQ/CQ环
+ * IORING_OP_POLL_ADD / IORING_OP_POLL_REMOVE 监听fd的事件
+ * io_uring_enter   一次系统调用同时提交所有的poll请求并等待完成事件
+ * 
+ * 使用一次性的poll，fd有事件上报以后，下一轮poll再重新提交   重新提交时内核会立即检查fd的状态，
+ * 所以对上层来说和epoll的LT模式语义一致（TcpConnection/Acceptor每次事件只读一次，依赖LT）
+ * 对fd感兴趣事件的修改也只是记录下来，下一轮统一提交，不需要每次epoll_ctl
+ * 边缘触发的channel（上层会读写到EAGAIN）使用multishot poll，一次提交持续有效
+ */ 
+class IoUringPoller : public Poller
+{
+public:
+    IoUringPoller(EventLoop *loop);
+    ~IoUringPoller() override;
+
+    // 内核不支持io_uring（或者缺少需要的特性）时返回false，调用方应该换成其它Poller
+    bool valid() const { return ringFd_ >= 0; }
+
+    Timestamp poll(int timeoutMs, ChannelList *activeChannels) override;
+    void updateChannel(Channel *channel) override;
+    void removeChannel(Channel *channel) override;
+private:
+    static const unsigned kRingEntries = 1024;
+
+    // 每个fd在io_uring上的状态
+    struct PollState
+    {
+        PollState() : armed(false), dirty(false), events(0), userData(0), round(0), revents(0) {}
+        bool armed; // 是否有还没完成的poll请求
+        bool dirty; // 感兴趣的事件变了，或者poll已经完成，需要在下一轮重新提交
+        int events; // 已提交的poll请求监听的事件
+        uint64_t userData; // 已提交的poll请求的user_data = 代数<<32 | fd，用来过滤过期的完成事件
+        uint64_t round; // 最近一次上报事件是在第几轮
+        int revents; // 本轮合并以后的事件
+    };
+
+    bool setupRing();
+    void markDirty(int fd, PollState &state);
+    // 把所有dirty的fd的poll请求放到SQ上
+    void flushDirty();
+    io_uring_sqe* getSqe();
+    void pollAdd(int fd, int events, uint64_t userData, bool multishot);
+    void pollRemove(uint64_t userData);
+    // 处理CQ上的完成事件
+    void reapCompletions(ChannelList *activeChannels);
+
+    int ringFd_;
+    unsigned features_;
+
+    void *sqRing_;
+    size_t sqRingSize_;
+    void *cqRing_;
+    size_t cqRingSize_;
+    io_uring_sqe *sqes_;
+    size_t sqesSize_;
+
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    unsigned *sqArray_;
+    unsigned sqLocalTail_; // 还没有发布给内核的SQ尾部
+    unsigned toSubmit_;
+
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe *cqes_;
+
+    uint32_t nextGeneration_;
+    uint64_t round_; // reapCompletions的轮数
+    std::vector<PollState> states_; // 和channels_一样用fd作下标
+    std::vector<int> dirtyFds_;
+};
+
+#endif // MUDUO_HAVE_IO_URING
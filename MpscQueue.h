@@ -0,0 +1,82 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <utility>
+#include <stddef.h>
+
+/**
+ * 无锁的多生产者单消费者队列（Dmitry Vyukov的算法）
+ * push可以在任意线程中并发调用，只需要一次原子exchange
+ * pop/size只能由唯一的消费者线程调用（EventLoop所在的线程）
+ * 
+ * 生产者exchange了head_但还没来得及链接next的这段时间里，消费者会认为队列到头了，
+ * 这个生产者随后会wakeup消费者，所以元素不会丢失
+ */ 
+template <typename T>
+class MpscQueue : noncopyable
+{
+public:
+    MpscQueue()
+        : head_(&stub_)
+        , tail_(&stub_)
+        , size_(0)
+    {}
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(&value)) {}
+        if (tail_ != &stub_)
+        {
+            delete tail_; // 最后取出的那个节点充当着哨兵
+        }
+    }
+
+    // 只接受右值，元素一路移动到节点里，不会多拷贝一次
+    void push(T &&value)
+    {
+        Node *node = new Node(std::move(value));
+        size_.fetch_add(1, std::memory_order_relaxed);
+        Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 只能在消费者线程调用，队列为空（或者链接还没完成）返回false
+    bool pop(T *value)
+    {
+        Node *tail = tail_;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+        *value = std::move(next->value);
+        tail_ = next; // next成为新的哨兵节点
+        if (tail != &stub_)
+        {
+            delete tail;
+        }
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 近似值，只用来限制一轮处理的个数，以及判断是否有待处理的元素
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    bool empty() const { return size() == 0; }
+private:
+    struct Node
+    {
+        Node() : next(nullptr) {}
+        explicit Node(T &&v) : next(nullptr), value(std::move(v)) {}
+
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    Node stub_;
+    std::atomic<Node*> head_; // 生产者从这里插入
+    Node *tail_; // 消费者从这里取出，只有消费者线程访问
+    std::atomic<size_t> size_;
+};
@@ -0,0 +1,116 @@
+#include "PollPoller.h"
+#include "Logger.h"
+#include "Channel.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <algorithm>
+
+PollPoller::PollPoller(EventLoop *loop)
+    : Poller(loop)
+{
+}
+
+PollPoller::~PollPoller()
+{
+}
+
+Timestamp PollPoller::poll(int timeoutMs, ChannelList *activeChannels)
+{
+    LOG_DEBUG("func=%s => fd total count:%lu \n", __FUNCTION__, pollfds_.size());
+
+    int numEvents = ::poll(pollfds_.data(), pollfds_.size(), timeoutMs);
+    int saveErrno = errno;
+    Timestamp now(Timestamp::now());
+
+    if (numEvents > 0)
+    {
+        LOG_DEBUG("%d events happened \n", numEvents);
+        fillActiveChannels(numEvents, activeChannels);
+    }
+    else if (numEvents == 0)
+    {
+        LOG_DEBUG("%s timeout! \n", __FUNCTION__);
+    }
+    else
+    {
+        if (saveErrno != EINTR)
+        {
+            errno = saveErrno;
+            LOG_ERROR("PollPoller::poll() err!");
+        }
+    }
+    return now;
+}
+
+// 填写活跃的连接，找够numEvents个就可以提前结束了
+void PollPoller::fillActiveChannels(int numEvents, ChannelList *activeChannels) const
+{
+    for (PollFdList::const_iterator pfd = pollfds_.begin();
+        pfd != pollfds_.end() && numEvents > 0; ++pfd)
+    {
+        if (pfd->revents > 0)
+        {
+            --numEvents;
+            Channel *channel = findChannel(pfd->fd);
+            channel->set_revents(pfd->revents);
+            activeChannels->push_back(channel);
+        }
+    }
+}
+
+void PollPoller::updateChannel(Channel *channel)
+{
+    LOG_DEBUG("func=%s => fd=%d events=%d index=%d \n", __FUNCTION__, channel->fd(), channel->events(), channel->index());
+
+    if (channel->index() < 0)
+    {
+        // 新的channel，加到pollfds_的末尾
+        struct pollfd pfd;
+        pfd.fd = channel->fd();
+        pfd.events = static_cast<short>(channel->events());
+        pfd.revents = 0;
+        pollfds_.push_back(pfd);
+        channel->set_index(static_cast<int>(pollfds_.size()) - 1);
+        addChannelToMap(channel);
+    }
+    else
+    {
+        // 已经存在的channel，直接修改对应的pollfd
+        struct pollfd &pfd = pollfds_[channel->index()];
+        pfd.fd = channel->fd();
+        pfd.events = static_cast<short>(channel->events());
+        pfd.revents = 0;
+        if (channel->isNoneEvent())
+        {
+            // 不关心任何事件，poll会忽略fd为负数的项    -fd-1保证fd为0时也是负数
+            pfd.fd = -channel->fd() - 1;
+        }
+    }
+}
+
+void PollPoller::removeChannel(Channel *channel)
+{
+    LOG_DEBUG("func=%s => fd=%d\n", __FUNCTION__, channel->fd());
+
+    int idx = channel->index();
+    removeChannelFromMap(channel->fd());
+    if (idx < 0)
+    {
+        return;
+    }
+
+    if (static_cast<size_t>(idx) != pollfds_.size() - 1)
+    {
+        // 把最后一个元素换到被删除的位置，并更新被换过来的channel的下标
+        int channelAtEnd = pollfds_.back().fd;
+        std::iter_swap(pollfds_.begin() + idx, pollfds_.end() - 1);
+        if (channelAtEnd < 0)
+        {
+            channelAtEnd = -channelAtEnd - 1;
+        }
+        findChannel(channelAtEnd)->set_index(idx);
+    }
+    pollfds_.pop_back();
+    channel->set_index(-1);
+}
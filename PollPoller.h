@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Poller.h"
+#include "Timestamp.h"
+
+#include <vector>
+
+struct pollfd;
+class Channel;
+
+/**
+ * poll的使用
+ * pollfds_是一个紧凑的pollfd数组，channel的index_就是它在数组中的下标
+ * 删除时把最后一个元素换到被删除的位置，O(1)
+ */ 
+class PollPoller : public Poller
+{
+public:
+    PollPoller(EventLoop *loop);
+    ~PollPoller() override;
+
+    Timestamp poll(int timeoutMs, ChannelList *activeChannels) override;
+    void updateChannel(Channel *channel) override;
+    void removeChannel(Channel *channel) override;
+private:
+    void fillActiveChannels(int numEvents, ChannelList *activeChannels) const;
+
+    using PollFdList = std::vector<struct pollfd>;
+    PollFdList pollfds_;
+};
@@ -1,13 +1,40 @@
 #include "Poller.h"
 #include "Channel.h"
 
+#include <algorithm>
+
 Poller::Poller(EventLoop *loop)
-    : ownerLoop_(loop)
+    : numChannels_(0)
+    , ctlCalls_(0)
+    , ownerLoop_(loop)
 {
 }
 
 bool Poller::hasChannel(Channel *channel) const
 {
-    auto it = channels_.find(channel->fd());
-    return it != channels_.end() && it->second == channel;
+    return findChannel(channel->fd()) == channel;
+}
+
+void Poller::addChannelToMap(Channel *channel)
+{
+    size_t fd = static_cast<size_t>(channel->fd());
+    if (fd >= channels_.size())
+    {
+        // 按2倍扩容，保持均摊O(1)
+        channels_.resize(std::max(fd + 1, channels_.size() * 2), nullptr);
+    }
+    if (channels_[fd] == nullptr)
+    {
+        ++numChannels_;
+    }
+    channels_[fd] = channel;
+}
+
+void Poller::removeChannelFromMap(int fd)
+{
+    if (static_cast<size_t>(fd) < channels_.size() && channels_[fd] != nullptr)
+    {
+        channels_[fd] = nullptr;
+        --numChannels_;
+    }
 }
\ No newline at end of file
@@ -4,7 +4,8 @@
 #include "Timestamp.h"
 
 #include <vector>
-#include <unordered_map>
+#include <atomic>
+#include <stdint.h>
 
 class Channel;
 class EventLoop;
@@ -26,12 +27,27 @@ public:
     // 判断参数channel是否在当前Poller当中
     bool hasChannel(Channel *channel) const;
 
+    // 更新fd感兴趣事件的系统调用（epoll_ctl）次数，可以在其它线程读取
+    uint64_t ctlCalls() const { return ctlCalls_.load(std::memory_order_relaxed); }
+
     // EventLoop可以通过该接口获取默认的IO复用的具体实现
     static Poller* newDefaultPoller(EventLoop *loop);
 protected:
-    // map的key：sockfd  value：sockfd所属的channel通道类型
-    using ChannelMap = std::unordered_map<int, Channel*>;
+    // fd是从小到大连续分配的整数，直接用fd作下标：下标是sockfd  值是sockfd所属的channel通道，没有则为nullptr
+    // 比哈希表少了哈希和链表跳转，对缓存也更友好
+    using ChannelMap = std::vector<Channel*>;
+
+    Channel* findChannel(int fd) const
+    {
+        return static_cast<size_t>(fd) < channels_.size() ? channels_[fd] : nullptr;
+    }
+    void addChannelToMap(Channel *channel);
+    void removeChannelFromMap(int fd);
+    size_t numChannels() const { return numChannels_; }
+
     ChannelMap channels_;
+    size_t numChannels_; // channels_中非空的个数
+    std::atomic<uint64_t> ctlCalls_; // 只在loop线程中修改
 private:
     EventLoop *ownerLoop_; // 定义Poller所属的事件循环EventLoop
 };
\ No newline at end of file
@@ -3,10 +3,12 @@
 #include "InetAddress.h"
 
 #include <unistd.h>
+#include <errno.h>
 #include <sys/types.h>         
 #include <sys/socket.h>
 #include <strings.h>
 #include <netinet/tcp.h>
+#include <linux/filter.h>
 #include <sys/socket.h>
 
 Socket::~Socket()
@@ -49,6 +51,34 @@ int Socket::accept(InetAddress *peeraddr)
     return connfd;
 }
 
+int Socket::acceptBatch(int *connfds, InetAddress *peeraddrs, int maxCount, int *savedErrno)
+{
+    int count = 0;
+    *savedErrno = 0;
+    for (int attempts = 0; attempts < maxCount; ++attempts)
+    {
+        sockaddr_in addr;
+        socklen_t len = sizeof addr;
+        int connfd = ::accept4(sockfd_, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd >= 0)
+        {
+            connfds[count] = connfd;
+            peeraddrs[count].setSockAddr(addr);
+            ++count;
+        }
+        else if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR)
+        {
+            continue; // 对端在accept之前就断开了之类的暂时性错误，跳过这个继续
+        }
+        else
+        {
+            *savedErrno = errno; // EAGAIN说明队列已经取空了
+            break;
+        }
+    }
+    return count;
+}
+
 void Socket::shutdownWrite()
 {
     if (::shutdown(sockfd_, SHUT_WR) < 0)
@@ -79,4 +109,41 @@ void Socket::setKeepAlive(bool on)
 {
     int optval = on ? 1 : 0;
     ::setsockopt(sockfd_, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof optval);
+}
+
+void Socket::setBusyPoll(int usec)
+{
+    if (::setsockopt(sockfd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec) < 0)
+    {
+        LOG_ERROR("setBusyPoll sockfd:%d usec:%d error:%d \n", sockfd_, usec, errno);
+    }
+}
+
+void Socket::setReusePortCpuSteering(const std::vector<int> &cpuToIndex)
+{
+    // 跳转表：A = 当前cpu，逐个比较，命中就返回组内下标  返回值超出组的大小时内核退回按哈希选
+    std::vector<struct sock_filter> code;
+    code.push_back({ BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) });
+    for (size_t cpu = 0; cpu < cpuToIndex.size(); ++cpu)
+    {
+        if (cpuToIndex[cpu] < 0)
+        {
+            continue;
+        }
+        if (code.size() + 3 > BPF_MAXINSNS)
+        {
+            LOG_ERROR("setReusePortCpuSteering sockfd:%d too many cpus, cpu %zu and above use hash \n", sockfd_, cpu);
+            break;
+        }
+        code.push_back({ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, static_cast<uint32_t>(cpu) }); // 不相等跳过下一条
+        code.push_back({ BPF_RET | BPF_K, 0, 0, static_cast<uint32_t>(cpuToIndex[cpu]) });
+    }
+    code.push_back({ BPF_RET | BPF_K, 0, 0, 0xffffffff });
+    struct sock_fprog prog;
+    prog.len = static_cast<unsigned short>(code.size());
+    prog.filter = code.data();
+    if (::setsockopt(sockfd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) < 0)
+    {
+        LOG_ERROR("setReusePortCpuSteering sockfd:%d error:%d \n", sockfd_, errno);
+    }
 }
\ No newline at end of file
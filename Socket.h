@@ -2,6 +2,8 @@
 
 #include "noncopyable.h"
 
+#include <vector>
+
 class InetAddress;
 
 // 封装socket fd
@@ -18,6 +20,8 @@ public:
     void bindAddress(const InetAddress &localaddr);
     void listen();
     int accept(InetAddress *peeraddr);
+    // 连续accept，最多maxCount个，遇到EAGAIN或者错误停下，返回accept到的个数，停下时的errno存在savedErrno里
+    int acceptBatch(int *connfds, InetAddress *peeraddrs, int maxCount, int *savedErrno);
 
     void shutdownWrite();
 
@@ -25,6 +29,11 @@ public:
     void setReuseAddr(bool on);
     void setReusePort(bool on);
     void setKeepAlive(bool on);
+    // SO_BUSY_POLL，读socket时在驱动队列上自旋等待usec微秒
+    void setBusyPoll(int usec);
+    // 给SO_REUSEPORT组挂一个CBPF程序，收到新连接的cpu为c时交给组里第cpuToIndex[c]个socket
+    // 不在表里（或者为-1）的cpu交给内核按四元组哈希选
+    void setReusePortCpuSteering(const std::vector<int> &cpuToIndex);
 private:
     const int sockfd_;
 };
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <sys/socket.h>
 #include <strings.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <string>
 
@@ -23,19 +24,25 @@ static EventLoop* CheckLoopNotNull(EventLoop *loop)
 }
 
 TcpConnection::TcpConnection(EventLoop *loop, 
-                const std::string &nameArg, 
+                const std::shared_ptr<const std::string> &namePrefix,
+                int64_t id,
                 int sockfd,
                 const InetAddress& localAddr,
                 const InetAddress& peerAddr)
     : loop_(CheckLoopNotNull(loop))
-    , name_(nameArg)
+    , namePrefix_(namePrefix)
+    , id_(id)
     , state_(kConnecting)
-    , reading_(true)
+    , pinCount_(0)
+    , deferredLoop_(nullptr)
     , socket_(new Socket(sockfd))
     , channel_(new Channel(loop, sockfd))
     , localAddr_(localAddr)
     , peerAddr_(peerAddr)
     , highWaterMark_(64*1024*1024) // 64M
+    , inputBuffer_(0)  // 用到的时候才分配
+    , outputBuffer_(0)
+    , flushQueued_(false)
 {
     // 下面给channel设置相应的回调函数，poller给channel通知感兴趣的事件发生了，channel会回调相应的操作函数
     channel_->setReadCallback(
@@ -51,33 +58,145 @@ TcpConnection::TcpConnection(EventLoop *loop,
         std::bind(&TcpConnection::handleError, this)
     );
 
-    LOG_INFO("TcpConnection::ctor[%s] at fd=%d\n", name_.c_str(), sockfd);
+    LOG_INFO("TcpConnection::ctor[%s#%lld] at fd=%d\n", namePrefix_->c_str(), (long long)id_, sockfd);
     socket_->setKeepAlive(true);
+    outputBuffer_.setSegmented(true); // 积压很多数据的时候也不会整体拷贝
+    getLoop()->connectionCountAdd(1); // 在选定loop的时候就计数，connectDestroyed里面减掉
 }
 
 
 TcpConnection::~TcpConnection()
 {
-    LOG_INFO("TcpConnection::dtor[%s] at fd=%d state=%d \n", 
-        name_.c_str(), channel_->fd(), (int)state_);
+    LOG_INFO("TcpConnection::dtor[%s#%lld] at fd=%d state=%d \n", 
+        namePrefix_->c_str(), (long long)id_, channel_->fd(), (int)state_);
+}
+
+std::string TcpConnection::name() const
+{
+    char buf[32] = {0};
+    snprintf(buf, sizeof buf, "#%lld", (long long)id_);
+    return *namePrefix_ + buf;
 }
 
 void TcpConnection::send(const std::string &buf)
 {
     if (state_ == kConnected)
     {
-        if (loop_->isInLoopThread())
+        if (getLoop()->isInLoopThread())
+        {
+            sendInLoop(buf.c_str(), buf.size());
+        }
+        else
+        {
+            // 调用方的字符串在发送之前可能就没了，拷贝一份
+            OutboundMessage message;
+            message.data = buf;
+            queueOutbound(std::move(message));
+        }
+    }
+}
+
+void TcpConnection::send(std::string &&buf)
+{
+    if (state_ == kConnected)
+    {
+        if (getLoop()->isInLoopThread())
         {
             sendInLoop(buf.c_str(), buf.size());
         }
         else
         {
-            loop_->runInLoop(std::bind(
-                &TcpConnection::sendInLoop,
-                this,
-                buf.c_str(),
-                buf.size()
-            ));
+            OutboundMessage message;
+            message.data = std::move(buf);
+            queueOutbound(std::move(message));
+        }
+    }
+}
+
+void TcpConnection::send(Buffer *buf)
+{
+    if (state_ == kConnected)
+    {
+        if (getLoop()->isInLoopThread())
+        {
+            sendBufferInLoop(buf);
+        }
+        else
+        {
+            OutboundMessage message;
+            message.kind = OutboundMessage::kBuffer;
+            message.buffer.reset(new Buffer(0));
+            message.buffer->swap(*buf);
+            queueOutbound(std::move(message));
+        }
+    }
+}
+
+// writev一次最多带的段数
+static const int kMaxSendIovecs = 64;
+
+void TcpConnection::sendBufferInLoop(Buffer *buf)
+{
+    if (state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing!");
+        buf->retrieveAll();
+        return;
+    }
+
+    // 按段直接writev，发不完的部分整段接到outputBuffer后面，分段的Buffer不会被拼成一整块
+    struct iovec vec[kMaxSendIovecs];
+    size_t len = buf->readableBytes();
+    ssize_t nwrote = writeDirectly(vec, buf->peekSegments(vec, kMaxSendIovecs), len);
+    if (nwrote < 0)
+    {
+        buf->retrieveAll();
+        return;
+    }
+    buf->retrieve(nwrote);
+
+    size_t remaining = buf->readableBytes();
+    if (remaining > 0)
+    {
+        outputBuffer_.splice(buf);
+        outputBuffered(remaining);
+    }
+}
+
+void TcpConnection::queueOutbound(OutboundMessage &&message)
+{
+    outboundQueue_.push(std::move(message));
+    // 已经有一个flush在排队的话它会把这条一起发掉，一批send只唤醒loop一次
+    if (!flushQueued_.exchange(true, std::memory_order_acq_rel))
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::flushOutbound, shared_from_this()));
+    }
+}
+
+void TcpConnection::flushOutbound()
+{
+    if (!getLoop()->isInLoopThread())
+    {
+        // 排队期间连接迁移走了，到新的loop上去发
+        getLoop()->queueInLoop(std::bind(&TcpConnection::flushOutbound, shared_from_this()));
+        return;
+    }
+    // 先清标志再取：之后push的send会再排一次flush   用exchange和生产者的exchange同步，保证看得到它们push的数据
+    flushQueued_.exchange(false, std::memory_order_acq_rel);
+    OutboundMessage message;
+    while (outboundQueue_.pop(&message))
+    {
+        switch (message.kind)
+        {
+        case OutboundMessage::kSlices:
+            sendSliceVectorInLoop(message.slices);
+            break;
+        case OutboundMessage::kBuffer:
+            sendBufferInLoop(message.buffer.get());
+            break;
+        default:
+            sendInLoop(message.data.data(), message.data.size());
+            break;
         }
     }
 }
@@ -87,9 +206,16 @@ void TcpConnection::send(const std::string &buf)
  */ 
 void TcpConnection::sendInLoop(const void* data, size_t len)
 {
-    ssize_t nwrote = 0;
-    size_t remaining = len;
-    bool faultError = false;
+    if (!getLoop()->isInLoopThread())
+    {
+        // 排队期间连接迁移到了别的loop上，拷贝一份数据转发过去
+        getLoop()->queueInLoop(std::bind(
+            &TcpConnection::sendStringInLoop, 
+            shared_from_this(), 
+            std::string(static_cast<const char*>(data), len)
+        ));
+        return;
+    }
 
     // 之前调用过该connection的shutdown，不能再进行发送了
     if (state_ == kDisconnected)
@@ -98,65 +224,182 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
         return;
     }
 
-    // 表示channel_第一次开始写数据，而且缓冲区没有待发送数据
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+    struct iovec vec;
+    vec.iov_base = const_cast<void*>(data);
+    vec.iov_len = len;
+    ssize_t nwrote = writeDirectly(&vec, 1, len);
+    if (nwrote < 0)
+    {
+        return;
+    }
+
+    // 说明当前这一次write，并没有把数据全部发送出去，剩余的数据需要保存到缓冲区当中
+    size_t remaining = len - nwrote;
+    if (remaining > 0) 
     {
-        nwrote = ::write(channel_->fd(), data, len);
-        if (nwrote >= 0)
+        outputBuffer_.append(static_cast<const char*>(data) + nwrote, remaining);
+        outputBuffered(remaining);
+    }
+}
+
+void TcpConnection::sendStringInLoop(const std::string &message)
+{
+    sendInLoop(message.data(), message.size());
+}
+
+ssize_t TcpConnection::writeDirectly(const struct iovec *vec, int iovcnt, size_t len)
+{
+    // 只有channel_还没开始写，而且缓冲区没有待发送数据的时候才能直接写，否则会乱序
+    if (channel_->isWriting() || outputBuffer_.readableBytes() > 0)
+    {
+        return 0;
+    }
+    ssize_t nwrote = iovcnt == 1 ? ::write(channel_->fd(), vec[0].iov_base, vec[0].iov_len)
+                                 : ::writev(channel_->fd(), vec, iovcnt);
+    if (nwrote >= 0)
+    {
+        if (static_cast<size_t>(nwrote) == len && writeCompleteCallback_)
         {
-            remaining = len - nwrote;
-            if (remaining == 0 && writeCompleteCallback_)
-            {
-                // 既然在这里数据全部发送完成，就不用再给channel设置epollout事件了
-                loop_->queueInLoop(
-                    std::bind(writeCompleteCallback_, shared_from_this())
-                );
-            }
+            // 既然在这里数据全部发送完成，就不用再给channel设置epollout事件了
+            getLoop()->queueInLoop(
+                std::bind(writeCompleteCallback_, shared_from_this())
+            );
         }
-        else // nwrote < 0
+        return nwrote;
+    }
+    if (errno != EWOULDBLOCK)
+    {
+        LOG_ERROR("TcpConnection::sendInLoop");
+        if (errno == EPIPE || errno == ECONNRESET) // SIGPIPE  RESET
         {
-            nwrote = 0;
-            if (errno != EWOULDBLOCK)
-            {
-                LOG_ERROR("TcpConnection::sendInLoop");
-                if (errno == EPIPE || errno == ECONNRESET) // SIGPIPE  RESET
-                {
-                    faultError = true;
-                }
-            }
+            return -1;
         }
     }
+    return 0;
+}
+
+void TcpConnection::outputBuffered(size_t added)
+{
+    // 刚跨过高水位的时候通知一次
+    size_t newLen = outputBuffer_.readableBytes();
+    size_t oldLen = newLen - added;
+    if (newLen >= highWaterMark_
+        && oldLen < highWaterMark_
+        && highWaterMarkCallback_)
+    {
+        getLoop()->queueInLoop(
+            std::bind(highWaterMarkCallback_, shared_from_this(), newLen)
+        );
+    }
+    // 这里一定要注册channel的写事件，否则poller不会给channel通知epollout
+    // poller发现tcp的发送缓冲区有空间，会调用TcpConnection::handleWrite方法，把发送缓冲区中的数据全部发送完成
+    if (!channel_->isWriting())
+    {
+        channel_->enableWriting();
+    }
+}
 
-    // 说明当前这一次write，并没有把数据全部发送出去，剩余的数据需要保存到缓冲区当中，然后给channel
-    // 注册epollout事件，poller发现tcp的发送缓冲区有空间，会通知相应的sock-channel，调用writeCallback_回调方法
-    // 也就是调用TcpConnection::handleWrite方法，把发送缓冲区中的数据全部发送完成
-    if (!faultError && remaining > 0) 
+void TcpConnection::send(const Buffer::Slice &slice)
+{
+    if (state_ == kConnected)
     {
-        // 目前发送缓冲区剩余的待发送数据的长度
-        size_t oldLen = outputBuffer_.readableBytes();
-        if (oldLen + remaining >= highWaterMark_
-            && oldLen < highWaterMark_
-            && highWaterMarkCallback_)
+        if (getLoop()->isInLoopThread())
         {
-            loop_->queueInLoop(
-                std::bind(highWaterMarkCallback_, shared_from_this(), oldLen+remaining)
-            );
+            sendSlicesInLoop(&slice, 1);
         }
-        outputBuffer_.append((char*)data + nwrote, remaining);
-        if (!channel_->isWriting())
+        else
+        {
+            OutboundMessage message;
+            message.kind = OutboundMessage::kSlices;
+            message.slices.push_back(slice);
+            queueOutbound(std::move(message));
+        }
+    }
+}
+
+void TcpConnection::send(const std::vector<Buffer::Slice> &slices)
+{
+    if (state_ == kConnected)
+    {
+        if (getLoop()->isInLoopThread())
+        {
+            sendSlicesInLoop(slices.data(), slices.size());
+        }
+        else
         {
-            channel_->enableWriting(); // 这里一定要注册channel的写事件，否则poller不会给channel通知epollout
+            // 拷贝的只是shared_ptr
+            OutboundMessage message;
+            message.kind = OutboundMessage::kSlices;
+            message.slices = slices;
+            queueOutbound(std::move(message));
         }
     }
 }
 
+void TcpConnection::sendSlicesInLoop(const Buffer::Slice *slices, size_t count)
+{
+    if (!getLoop()->isInLoopThread())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendSliceVectorInLoop, shared_from_this(),
+            std::vector<Buffer::Slice>(slices, slices + count)));
+        return;
+    }
+    if (state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing!");
+        return;
+    }
+
+    size_t len = 0;
+    struct iovec vec[kMaxSendIovecs];
+    int iovcnt = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        len += slices[i]->size();
+        if (iovcnt < kMaxSendIovecs)
+        {
+            vec[iovcnt].iov_base = const_cast<char*>(slices[i]->data());
+            vec[iovcnt].iov_len = slices[i]->size();
+            ++iovcnt;
+        }
+    }
+    ssize_t nwrote = writeDirectly(vec, iovcnt, len);
+    if (nwrote < 0)
+    {
+        return;
+    }
+
+    size_t remaining = len - nwrote;
+    if (remaining > 0)
+    {
+        // 跳过已经发出去的部分，剩下的按引用挂到outputBuffer上
+        size_t skip = nwrote;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (skip >= slices[i]->size())
+            {
+                skip -= slices[i]->size();
+                continue;
+            }
+            outputBuffer_.appendSlice(slices[i], skip);
+            skip = 0;
+        }
+        outputBuffered(remaining);
+    }
+}
+
+void TcpConnection::sendSliceVectorInLoop(const std::vector<Buffer::Slice> &slices)
+{
+    sendSlicesInLoop(slices.data(), slices.size());
+}
+
 // 关闭连接
 void TcpConnection::shutdown()
 {
     if (state_ == kConnected)
     {
         setState(kDisconnecting);
-        loop_->runInLoop(
+        getLoop()->runInLoop(
             std::bind(&TcpConnection::shutdownInLoop, this)
         );
     }
@@ -164,12 +407,140 @@ void TcpConnection::shutdown()
 
 void TcpConnection::shutdownInLoop()
 {
+    if (!getLoop()->isInLoopThread())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::shutdownInLoop, shared_from_this()));
+        return;
+    }
     if (!channel_->isWriting()) // 说明outputBuffer中的数据已经全部发送完成
     {
         socket_->shutdownWrite(); // 关闭写端
     }
 }
 
+void TcpConnection::forceClose()
+{
+    if (state_ == kConnected || state_ == kDisconnecting)
+    {
+        setState(kDisconnecting);
+        getLoop()->queueInLoop(
+            std::bind(&TcpConnection::forceCloseInLoop, shared_from_this())
+        );
+    }
+}
+
+void TcpConnection::setEdgeTriggered(bool on)
+{
+    channel_->setEdgeTriggered(on);
+}
+
+void TcpConnection::setSocketBusyPoll(int usec)
+{
+    socket_->setBusyPoll(usec);
+}
+
+void TcpConnection::forceCloseInLoop()
+{
+    if (!getLoop()->isInLoopThread())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::forceCloseInLoop, shared_from_this()));
+        return;
+    }
+    if (state_ == kConnected || state_ == kDisconnecting)
+    {
+        handleClose(); // 和对端关闭连接走一样的流程
+    }
+}
+
+void TcpConnection::migrateTo(EventLoop *newLoop, const std::shared_ptr<TimingWheel> &newWheel,
+                              const MigrateCallback &cb)
+{
+    // 总是排队执行，保证channel不在原loop本轮的activeChannels里面
+    EventLoop *oldLoop = getLoop();
+    oldLoop->queueInLoop(
+        std::bind(&TcpConnection::migrateOutOfLoop, shared_from_this(), oldLoop, newLoop, newWheel, cb)
+    );
+}
+
+void TcpConnection::migrateOutOfLoop(EventLoop *oldLoop, EventLoop *newLoop,
+                                     const std::shared_ptr<TimingWheel> &newWheel, const MigrateCallback &cb)
+{
+    // 在oldLoop线程里执行，loop_只会被当前所属的线程修改，这里读到的一定是最新的
+    // 排队期间已经被别的迁移搬走了，或者连接正在关闭：放弃，把newLoop上预留的连接数还回去
+    if (getLoop() != oldLoop || state_ != kConnected || newLoop == oldLoop)
+    {
+        newLoop->connectionCountAdd(-1);
+        return;
+    }
+    if (pinCount_ > 0)
+    {
+        // 连接表还没动，unpinLoop以后再迁移  新的请求替换掉旧的，旧目标上的预留还回去
+        if (deferredLoop_ != nullptr)
+        {
+            deferredLoop_->connectionCountAdd(-1);
+        }
+        deferredLoop_ = newLoop;
+        deferredWheel_ = newWheel;
+        deferredCallback_ = cb;
+        return;
+    }
+
+    if (cb)
+    {
+        cb(shared_from_this());
+    }
+    if (idleWheel_)
+    {
+        idleWheel_->remove(&idleEntry_);
+    }
+    channel_->disableAll();
+    channel_->remove(); // 从原loop的poller上摘掉
+
+    oldLoop->connectionCountAdd(-1); // newLoop上的计数调用方已经预留了
+    channel_->setOwnerLoop(newLoop);
+    idleWheel_ = newWheel;
+    loop_.store(newLoop, std::memory_order_release); // 之后排到原loop上的InLoop操作都会转发到newLoop
+
+    newLoop->queueInLoop(
+        std::bind(&TcpConnection::migrateIntoLoop, shared_from_this())
+    );
+}
+
+void TcpConnection::unpinLoop()
+{
+    if (--pinCount_ == 0 && deferredLoop_ != nullptr)
+    {
+        // 预留的连接数交给这次迁移
+        EventLoop *newLoop = deferredLoop_;
+        std::shared_ptr<TimingWheel> newWheel;
+        newWheel.swap(deferredWheel_);
+        MigrateCallback cb;
+        cb.swap(deferredCallback_);
+        deferredLoop_ = nullptr;
+        migrateTo(newLoop, newWheel, cb);
+    }
+}
+
+void TcpConnection::migrateIntoLoop()
+{
+    // 还没轮到这里执行就又被迁走了（新的迁移会自己注册），或者迁移途中被forceClose了
+    if (!getLoop()->isInLoopThread() || state_ == kDisconnected)
+    {
+        return;
+    }
+    // 关注的事件按连接的状态恢复，而不是迁出时的快照，因为迁入之前可能又有send排到了这里
+    // 重新注册时poller会检查fd当前的状态，迁移期间到达的数据在ET模式下也能收到通知
+    channel_->enableReading();
+    if (outputBuffer_.readableBytes() > 0)
+    {
+        channel_->enableWriting();
+    }
+    if (idleWheel_)
+    {
+        idleWheel_->add(&idleEntry_);
+    }
+}
+
 // 连接建立
 void TcpConnection::connectEstablished()
 {
@@ -177,6 +548,13 @@ void TcpConnection::connectEstablished()
     channel_->tie(shared_from_this());
     channel_->enableReading(); // 向poller注册channel的epollin事件
 
+    if (idleWheel_)
+    {
+        // 连接关闭时会从时间轮上摘掉idleEntry_，所以超时回调里面的this一定有效
+        idleEntry_.expireCallback = std::bind(&TcpConnection::forceCloseInLoop, this);
+        idleWheel_->add(&idleEntry_);
+    }
+
     // 新连接建立，执行回调
     connectionCallback_(shared_from_this());
 }
@@ -190,23 +568,70 @@ void TcpConnection::connectDestroyed()
         channel_->disableAll(); // 把channel的所有感兴趣的事件，从poller中del掉
         connectionCallback_(shared_from_this());
     }
+    if (idleWheel_)
+    {
+        idleWheel_->remove(&idleEntry_);
+    }
     channel_->remove(); // 把channel从poller中删除掉
+    getLoop()->connectionCountAdd(-1);
+    if (deferredLoop_ != nullptr)
+    {
+        // 推迟的迁移不会再执行了，还回预留的连接数
+        deferredLoop_->connectionCountAdd(-1);
+        deferredLoop_ = nullptr;
+        deferredWheel_.reset();
+        deferredCallback_ = nullptr;
+    }
 }
 
+// ET模式下每次事件最多读写这么多字节，没读写完的部分让出loop，排到队列后面再继续，防止一个连接饿死loop上的其它连接
+static const size_t kEdgeTriggeredBudget = 1024 * 1024;
+
 void TcpConnection::handleRead(Timestamp receiveTime)
 {
     int savedErrno = 0;
     ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
-    if (n > 0)
+    size_t total = n > 0 ? n : 0;
+    const bool edgeTriggered = channel_->edgeTriggered();
+    if (edgeTriggered)
+    {
+        // ET模式下必须读到EAGAIN，否则剩下的数据不会再有通知
+        while (n > 0 && total < kEdgeTriggeredBudget)
+        {
+            n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
+            if (n > 0)
+            {
+                total += n;
+            }
+        }
+    }
+
+    if (total > 0)
     {
+        if (idleWheel_)
+        {
+            idleWheel_->refresh(&idleEntry_); // O(1)，不分配内存
+        }
         // 已建立连接的用户，有可读事件发生了，调用用户传入的回调操作onMessage
         messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+        inputBuffer_.release(); // 上层全部取走了就把内存还回去，空闲的连接不占接收缓冲区
+    }
+
+    if (n > 0)
+    {
+        // ET模式预算用完了，socket里面还有数据，排队继续读   LT模式只读一次，剩下的数据poller会再通知
+        if (edgeTriggered)
+        {
+            getLoop()->queueInLoop(
+                std::bind(&TcpConnection::continueReading, shared_from_this())
+            );
+        }
     }
     else if (n == 0)
     {
         handleClose();
     }
-    else
+    else if (!(edgeTriggered && (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK)))
     {
         errno = savedErrno;
         LOG_ERROR("TcpConnection::handleRead");
@@ -214,22 +639,47 @@ void TcpConnection::handleRead(Timestamp receiveTime)
     }
 }
 
+void TcpConnection::continueReading()
+{
+    if (!getLoop()->isInLoopThread())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::continueReading, shared_from_this()));
+        return;
+    }
+    if (state_ == kConnected || state_ == kDisconnecting)
+    {
+        handleRead(Timestamp::now());
+    }
+}
+
 void TcpConnection::handleWrite()
 {
     if (channel_->isWriting())
     {
         int savedErrno = 0;
-        ssize_t n = outputBuffer_.writeFd(channel_->fd(), &savedErrno);
-        if (n > 0)
+        size_t total = 0;
+        ssize_t n = 0;
+        do
+        {
+            n = outputBuffer_.writeFd(channel_->fd(), &savedErrno);
+            if (n > 0)
+            {
+                outputBuffer_.retrieve(n);
+                total += n;
+            }
+            // ET模式下要一直写到EAGAIN或者写完为止
+        } while (channel_->edgeTriggered() && n > 0
+                && outputBuffer_.readableBytes() > 0 && total < kEdgeTriggeredBudget);
+
+        if (total > 0)
         {
-            outputBuffer_.retrieve(n);
             if (outputBuffer_.readableBytes() == 0)
             {
                 channel_->disableWriting();
                 if (writeCompleteCallback_)
                 {
                     // 唤醒loop_对应的thread线程，执行回调
-                    loop_->queueInLoop(
+                    getLoop()->queueInLoop(
                         std::bind(writeCompleteCallback_, shared_from_this())
                     );
                 }
@@ -238,8 +688,15 @@ void TcpConnection::handleWrite()
                     shutdownInLoop();
                 }
             }
+            else if (n > 0 && channel_->edgeTriggered())
+            {
+                // ET模式预算用完了，socket仍然可写，不会再有EPOLLOUT通知
+                getLoop()->queueInLoop(
+                    std::bind(&TcpConnection::continueWriting, shared_from_this())
+                );
+            }
         }
-        else
+        else if (!(channel_->edgeTriggered() && (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK)))
         {
             LOG_ERROR("TcpConnection::handleWrite");
         }
@@ -250,12 +707,29 @@ void TcpConnection::handleWrite()
     }
 }
 
+void TcpConnection::continueWriting()
+{
+    if (!getLoop()->isInLoopThread())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::continueWriting, shared_from_this()));
+        return;
+    }
+    if (channel_->isWriting())
+    {
+        handleWrite();
+    }
+}
+
 // poller => channel::closeCallback => TcpConnection::handleClose
 void TcpConnection::handleClose()
 {
     LOG_INFO("TcpConnection::handleClose fd=%d state=%d \n", channel_->fd(), (int)state_);
     setState(kDisconnected);
     channel_->disableAll();
+    if (idleWheel_)
+    {
+        idleWheel_->remove(&idleEntry_);
+    }
 
     TcpConnectionPtr connPtr(shared_from_this());
     connectionCallback_(connPtr); // 执行连接关闭的回调
@@ -275,5 +749,5 @@ void TcpConnection::handleError()
     {
         err = optval;
     }
-    LOG_ERROR("TcpConnection::handleError name:%s - SO_ERROR:%d \n", name_.c_str(), err);
+    LOG_ERROR("TcpConnection::handleError name:%s#%lld - SO_ERROR:%d \n", namePrefix_->c_str(), (long long)id_, err);
 }
\ No newline at end of file
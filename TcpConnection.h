@@ -5,14 +5,18 @@
 #include "Callbacks.h"
 #include "Buffer.h"
 #include "Timestamp.h"
+#include "TimingWheel.h"
+#include "MpscQueue.h"
 
 #include <memory>
 #include <string>
 #include <atomic>
+#include <vector>
 
 class Channel;
 class EventLoop;
 class Socket;
+struct iovec;
 
 /**
  * TcpServer => Acceptor => 有一个新用户连接，通过accept函数拿到connfd
@@ -22,24 +26,58 @@ class Socket;
 class TcpConnection : noncopyable, public std::enable_shared_from_this<TcpConnection>
 {
 public:
+    // 连接的名字是namePrefix#id，用到的时候才拼出来
     TcpConnection(EventLoop *loop, 
-                const std::string &name, 
+                const std::shared_ptr<const std::string> &namePrefix,
+                int64_t id,
                 int sockfd,
                 const InetAddress& localAddr,
                 const InetAddress& peerAddr);
     ~TcpConnection();
 
-    EventLoop* getLoop() const { return loop_; }
-    const std::string& name() const { return name_; }
+    // 连接迁移以后会变，任意线程都可以读
+    EventLoop* getLoop() const { return loop_.load(std::memory_order_acquire); }
+    std::string name() const;
+    // TcpServer分配的连接id，连接表的key，见ConnectionPool
+    int64_t id() const { return id_; }
     const InetAddress& localAddress() const { return localAddr_; }
     const InetAddress& peerAddress() const { return peerAddr_; }
 
     bool connected() const { return state_ == kConnected; }
 
-    // 发送数据
+    // 只能在loop线程中访问
+    Buffer* inputBuffer() { return &inputBuffer_; }
+    // 还没有交给内核的数据量   outputBuffer是分段的，peek看不到全部数据，所以不直接暴露
+    size_t outputBytes() const { return outputBuffer_.readableBytes(); }
+
+    // 给上层保存和连接绑定的任意数据
+    void setContext(const std::shared_ptr<void> &context) { context_ = context; }
+    const std::shared_ptr<void>& getContext() const { return context_; }
+
+    /**
+     * 发送数据，任意线程都可以调用
+     * 在别的线程调用时数据排进连接自己的无锁队列，一批只唤醒一次loop：const引用的版本拷贝一份，
+     * 右值的版本直接移动进去，Buffer的版本把buf的内容整个换走（调用后buf为空），都不会引用调用方的内存
+     */
     void send(const std::string &buf);
+    void send(std::string &&buf);
+    void send(Buffer *buf);
+    /**
+     * 按顺序发送一组共享的不可变数据（比如共享的header加上缓存好的body），任意线程都可以调用
+     * 直接writev发送，发不完的部分按引用挂在outputBuffer上，不会拷贝到每个连接的缓冲区里
+     * 发送完之前slice的内容不能再修改
+     */
+    void send(const Buffer::Slice &slice);
+    void send(const std::vector<Buffer::Slice> &slices);
     // 关闭连接
     void shutdown();
+    // 强制关闭连接，不等待outputBuffer中的数据发送完
+    void forceClose();
+
+    // 使用ET模式，读写时一直读写到EAGAIN，需要在connectEstablished之前调用
+    void setEdgeTriggered(bool on);
+    // 给连接的socket设置SO_BUSY_POLL
+    void setSocketBusyPoll(int usec);
 
     void setConnectionCallback(const ConnectionCallback& cb)
     { connectionCallback_ = cb; }
@@ -56,6 +94,27 @@ public:
     void setCloseCallback(const CloseCallback& cb)
     { closeCallback_ = cb; }
 
+    // 设置空闲连接的时间轮，需要在connectEstablished之前调用
+    void setIdleTimingWheel(const std::shared_ptr<TimingWheel> &wheel)
+    { idleWheel_ = wheel; }
+
+    /**
+     * 把连接迁移到newLoop上：在原loop上把channel从poller上摘下来，再到newLoop上重新注册
+     * fd、两个Buffer和读写关注的事件都保持不变，socket里面没读的数据留在内核里，不会丢
+     * newWheel是newLoop上的空闲时间轮（没有就传空），任意线程都可以调用
+     * 迁移之前排到原loop上的用户回调（比如writeComplete）还是会在原loop线程里执行
+     * 调用之前先在newLoop上预留一个连接数（connectionCountAdd(1)），迁移成功时这个计数跟着连接走，放弃时还回去，
+     * 所以迁移完成或者放弃之前newLoop不会被当成空loop销毁
+     * 连接已经不是kConnected，或者排队期间被别的迁移搬走了，就放弃这次迁移
+     * cb在真正迁出之前在原loop线程里调用，放弃的迁移不会调用，TcpServer在这里把连接表的条目搬过去
+     */ 
+    void migrateTo(EventLoop *newLoop, const std::shared_ptr<TimingWheel> &newWheel,
+                   const MigrateCallback &cb = MigrateCallback());
+    // 暂时禁止迁移，在所属loop线程中和unpinLoop成对调用（比如协程挂在当前loop的定时器上时）
+    // 期间收到的迁移请求推迟到最后一个unpinLoop以后再执行
+    void pinLoop() { ++pinCount_; }
+    void unpinLoop();
+
     // 连接建立
     void connectEstablished();
     // 连接销毁
@@ -66,16 +125,52 @@ private:
 
     void handleRead(Timestamp receiveTime);
     void handleWrite();
+    // ET模式下预算用完以后，排队继续读写
+    void continueReading();
+    void continueWriting();
     void handleClose();
     void handleError();
 
     void sendInLoop(const void* message, size_t len);
     void shutdownInLoop();
-
-    EventLoop *loop_; // 这里绝对不是baseLoop， 因为TcpConnection都是在subLoop里面管理的
-    const std::string name_;
+    void forceCloseInLoop();
+    void sendStringInLoop(const std::string &message);
+    void sendSlicesInLoop(const Buffer::Slice *slices, size_t count);
+    void sendSliceVectorInLoop(const std::vector<Buffer::Slice> &slices);
+    // 缓冲区里没有待发送的数据时先直接写，返回写出去的字节数，对端已经关闭（剩下的不用再缓存）返回-1
+    ssize_t writeDirectly(const struct iovec *vec, int iovcnt, size_t len);
+    // 刚往outputBuffer_追加了added字节：检查高水位，开始关注写事件
+    void outputBuffered(size_t added);
+    void sendBufferInLoop(Buffer *buf);
+
+    // 别的线程send的数据，按kind只有一个成员有内容   只能移动，移动不分配内存
+    struct OutboundMessage
+    {
+        enum Kind { kString, kBuffer, kSlices };
+
+        OutboundMessage() : kind(kString) {}
+        OutboundMessage(OutboundMessage &&) = default;
+        OutboundMessage& operator=(OutboundMessage &&) = default;
+
+        Kind kind;
+        std::string data;
+        std::unique_ptr<Buffer> buffer; // Buffer里有deque，移动也要分配，所以放在堆上只移动指针
+        std::vector<Buffer::Slice> slices;
+    };
+    void queueOutbound(OutboundMessage &&message);
+    void flushOutbound();
+    void migrateOutOfLoop(EventLoop *oldLoop, EventLoop *newLoop, const std::shared_ptr<TimingWheel> &newWheel,
+                          const MigrateCallback &cb);
+    void migrateIntoLoop();
+
+    std::atomic<EventLoop*> loop_; // 这里绝对不是baseLoop， 因为TcpConnection都是在subLoop里面管理的  迁移的时候会改变
+    const std::shared_ptr<const std::string> namePrefix_; // 同一个TcpServer的连接共用
+    const int64_t id_;
     std::atomic_int state_;
-    bool reading_;
+    int pinCount_; // 只在所属loop线程中访问
+    EventLoop *deferredLoop_; // pin期间推迟的迁移目标，为空表示没有  上面预留的连接数一直留着，loop不会被销毁
+    std::shared_ptr<TimingWheel> deferredWheel_;
+    MigrateCallback deferredCallback_;
 
     // 这里和Acceptor类似   Acceptor=》mainLoop    TcpConenction=》subLoop
     std::unique_ptr<Socket> socket_;
@@ -91,6 +186,13 @@ private:
     CloseCallback closeCallback_;
     size_t highWaterMark_;
 
-    Buffer inputBuffer_;  // 接收数据的缓冲区
-    Buffer outputBuffer_; // 发送数据的缓冲区
+    Buffer inputBuffer_;  // 接收数据的缓冲区  读空以后释放
+    Buffer outputBuffer_; // 发送数据的缓冲区  分段模式
+    MpscQueue<OutboundMessage> outboundQueue_; // 别的线程send的数据，loop线程按顺序取出来发送
+    std::atomic_bool flushQueued_; // 已经排了一个flushOutbound还没开始执行，后来的send不用再排
+
+    std::shared_ptr<void> context_;
+
+    std::shared_ptr<TimingWheel> idleWheel_; // 所在subLoop的时间轮，为空表示不检测空闲连接
+    TimingWheel::Entry idleEntry_; // 挂在时间轮上的节点，每次读到数据都会刷新
 };
\ No newline at end of file
@@ -1,9 +1,15 @@
 #include "TcpServer.h"
 #include "Logger.h"
 #include "TcpConnection.h"
+#include "EventLoopThread.h"
 
 #include <strings.h>
 #include <functional>
+#include <algorithm>
+#include <future>
+
+// 排空中的loop多久检查一次连接是否都已经离开
+static const double kRetireCheckInterval = 0.1;
 
 static EventLoop* CheckLoopNotNull(EventLoop *loop)
 {
@@ -19,14 +25,21 @@ TcpServer::TcpServer(EventLoop *loop,
                 const std::string &nameArg,
                 Option option)
                 : loop_(CheckLoopNotNull(loop))
+                , listenAddr_(listenAddr)
                 , ipPort_(listenAddr.toIpPort())
                 , name_(nameArg)
                 , acceptor_(new Acceptor(loop, listenAddr, option == kReusePort))
+                , acceptMode_(kBaseLoopAccept)
                 , threadPool_(new EventLoopThreadPool(loop, name_))
                 , connectionCallback_()
                 , messageCallback_()
-                , nextConnId_(1)
                 , started_(0)
+                , connNamePrefix_(std::make_shared<const std::string>(nameArg + "-" + listenAddr.toIpPort()))
+                , idleTimeoutSeconds_(0)
+                , socketBusyPollUs_(0)
+                , edgeTriggered_(false)
+                , rebalanceInterval_(0)
+                , rebalanceThresholdUs_(0)
 {
     // 当有先用户连接时，会执行TcpServer::newConnection回调
     acceptor_->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this, 
@@ -35,17 +48,54 @@ TcpServer::TcpServer(EventLoop *loop,
 
 TcpServer::~TcpServer()
 {
-    for (auto &item : connections_)
+    // 先同步关掉各个subloop上的Acceptor，之后就不会再有线程创建新连接、回调this了
+    while (!shardAcceptors_.empty())
+    {
+        removeShardAcceptor(shardAcceptors_.back().first);
+    }
+    if (rebalanceInterval_ > 0)
+    {
+        loop_->cancel(rebalanceTimer_);
+    }
+    if (!drainingLoops_.empty())
+    {
+        loop_->cancel(retireTimer_);
+    }
+    // 各个loop在自己的线程里销毁自己的连接，等它们都做完，LoopContext才能跟着TcpServer析构
+    for (auto &item : contexts_)
+    {
+        LoopContext *ctx = item.second.get();
+        if (ctx->loop->isInLoopThread())
+        {
+            destroyConnectionsInLoop(ctx);
+            continue;
+        }
+        std::promise<void> destroyed;
+        ctx->loop->runInLoop([this, ctx, &destroyed]() {
+            destroyConnectionsInLoop(ctx);
+            destroyed.set_value();
+        });
+        destroyed.get_future().wait();
+    }
+    // drainingLoops_里的loop会先于contexts_析构，时间轮要在各自的loop之前销毁
+    contexts_.clear();
+}
+
+void TcpServer::destroyConnectionsInLoop(LoopContext *ctx)
+{
+    for (auto &item : ctx->connections)
     {
         // 这个局部的shared_ptr智能指针对象，出右括号，可以自动释放new出来的TcpConnection对象资源了
         TcpConnectionPtr conn(item.second); 
         item.second.reset();
 
-        // 销毁连接
+        // 销毁连接  失败的迁移会让连接留在别的loop上
         conn->getLoop()->runInLoop(
             std::bind(&TcpConnection::connectDestroyed, conn)
         );
     }
+    ctx->connections.clear();
+    ctx->numConnections = 0;
 }
 
 // 设置底层subloop的个数
@@ -60,22 +110,277 @@ void TcpServer::start()
     if (started_++ == 0) // 防止一个TcpServer对象被start多次
     {
         threadPool_->start(threadInitCallback_); // 启动底层的loop线程池
-        loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        for (EventLoop *ioLoop : threadPool_->getAllLoops())
+        {
+            contextFor(ioLoop);
+        }
+        if (rebalanceInterval_ > 0)
+        {
+            rebalanceTimer_ = loop_->runEvery(rebalanceInterval_, std::bind(&TcpServer::rebalance, this));
+        }
+        if (acceptMode_ == kBaseLoopAccept)
+        {
+            loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        }
+        else
+        {
+            acceptor_.reset(); // 不用baseLoop上的Acceptor，释放它bind的端口
+            for (EventLoop *ioLoop : threadPool_->getAllLoops())
+            {
+                addShardAcceptor(contextFor(ioLoop));
+            }
+            updateCpuSteering();
+        }
+    }
+}
+
+TcpServer::LoopContext* TcpServer::contextFor(EventLoop *ioLoop)
+{
+    std::unique_ptr<LoopContext> &ctx = contexts_[ioLoop];
+    if (!ctx)
+    {
+        ctx.reset(new LoopContext(ioLoop));
+        size_t index = 0;
+        while (index < pools_.size() && !pools_[index].expired())
+        {
+            ++index;
+        }
+        if (index >= ConnectionPool::kMaxPools)
+        {
+            LOG_FATAL("%s:%s:%d too many loops! \n", __FILE__, __FUNCTION__, __LINE__);
+        }
+        ctx->pool = std::make_shared<ConnectionPool>(static_cast<int>(index));
+        if (index == pools_.size())
+        {
+            pools_.push_back(ctx->pool);
+        }
+        else
+        {
+            pools_[index] = ctx->pool;
+        }
+        if (idleTimeoutSeconds_ > 0)
+        {
+            ctx->idleWheel.reset(new TimingWheel(ioLoop, idleTimeoutSeconds_));
+            ioLoop->runInLoop(std::bind(&TimingWheel::start, ctx->idleWheel));
+        }
+    }
+    return ctx.get();
+}
+
+void TcpServer::addShardAcceptor(LoopContext *ctx)
+{
+    std::shared_ptr<Acceptor> acceptor(new Acceptor(ctx->loop, listenAddr_, true));
+    acceptor->setNewConnectionCallback(std::bind(&TcpServer::createConnection, this, 
+        ctx, std::placeholders::_1, std::placeholders::_2));
+    acceptor->listen(); // 在当前线程listen，保证组里socket的顺序和shardAcceptors_一致
+    shardAcceptors_.emplace_back(ctx->loop, acceptor);
+}
+
+// Acceptor的channel要在自己的loop里remove，这里等它真正关掉再返回
+void TcpServer::removeShardAcceptor(EventLoop *ioLoop)
+{
+    for (auto it = shardAcceptors_.begin(); it != shardAcceptors_.end(); ++it)
+    {
+        if (it->first == ioLoop)
+        {
+            std::shared_ptr<Acceptor> acceptor(std::move(it->second));
+            // 内核把组里最后一个socket挪到被关掉的位置上，这里也一样，cpu分流的下标才能对上
+            if (it + 1 != shardAcceptors_.end())
+            {
+                *it = std::move(shardAcceptors_.back());
+            }
+            shardAcceptors_.pop_back();
+
+            std::promise<void> closed;
+            ioLoop->runInLoop([&closed, acceptor]() mutable {
+                acceptor.reset();
+                closed.set_value();
+            });
+            closed.get_future().wait();
+            return;
+        }
+    }
+}
+
+void TcpServer::updateCpuSteering()
+{
+    if (acceptMode_ != kShardedAcceptCpuSteering || shardAcceptors_.empty())
+    {
+        return;
+    }
+    // 按每个分片的loop实际绑定的cpu建表，组里的顺序变了（增删分片）就重建
+    std::vector<int> cpuToIndex;
+    for (size_t i = 0; i < shardAcceptors_.size(); ++i)
+    {
+        std::vector<int> cpus = threadPool_->cpusOf(shardAcceptors_[i].first);
+        if (cpus.empty())
+        {
+            LOG_ERROR("TcpServer::updateCpuSteering [%s] - loop %p is not pinned to any cpu, it only gets hashed connections \n",
+                name_.c_str(), shardAcceptors_[i].first);
+        }
+        int shared = 0;
+        for (int cpu : cpus)
+        {
+            if (static_cast<size_t>(cpu) >= cpuToIndex.size())
+            {
+                cpuToIndex.resize(cpu + 1, -1);
+            }
+            if (cpuToIndex[cpu] >= 0)
+            {
+                ++shared; // 多个loop绑在同一个cpu上（比如loop比cpu多），这个cpu上的连接只交给第一个
+            }
+            else
+            {
+                cpuToIndex[cpu] = static_cast<int>(i);
+            }
+        }
+        if (!cpus.empty() && shared == static_cast<int>(cpus.size()))
+        {
+            LOG_ERROR("TcpServer::updateCpuSteering [%s] - loop %p shares all its cpus with other loops, it gets no steered connections \n",
+                name_.c_str(), shardAcceptors_[i].first);
+        }
+    }
+    // 程序是整个SO_REUSEPORT组共享的，挂在任意一个socket上就行
+    shardAcceptors_.front().second->setCpuSteering(cpuToIndex);
+}
+
+EventLoop* TcpServer::addLoop()
+{
+    EventLoop *ioLoop = threadPool_->addLoop();
+    LoopContext *ctx = contextFor(ioLoop);
+    if (acceptMode_ != kBaseLoopAccept)
+    {
+        addShardAcceptor(ctx);
+        updateCpuSteering();
+    }
+    LOG_INFO("TcpServer::addLoop [%s] - loop %p \n", name_.c_str(), ioLoop);
+    return ioLoop;
+}
+
+void TcpServer::drainLoop(EventLoop *ioLoop, bool migrate)
+{
+    std::unique_ptr<EventLoopThread> thread = threadPool_->detachLoop(ioLoop);
+    if (!thread)
+    {
+        LOG_ERROR("TcpServer::drainLoop [%s] - loop %p is not in the pool \n", name_.c_str(), ioLoop);
+        return;
+    }
+    if (acceptMode_ != kBaseLoopAccept)
+    {
+        // 关掉它的listen socket以后内核不再往这个loop分发（accept队列里还没取走的连接会被重置）
+        removeShardAcceptor(ioLoop);
+        updateCpuSteering();
+    }
+    LOG_INFO("TcpServer::drainLoop [%s] - loop %p with %d connections \n", 
+        name_.c_str(), ioLoop, ioLoop->activeConnections());
+
+    drainConnections(ioLoop, migrate);
+
+    if (drainingLoops_.empty())
+    {
+        retireTimer_ = loop_->runAfter(kRetireCheckInterval, std::bind(&TcpServer::retireDrainedLoops, this));
+    }
+    drainingLoops_.push_back(DrainingLoop{ ioLoop, std::move(thread), migrate });
+}
+
+void TcpServer::drainConnections(EventLoop *ioLoop, bool migrate)
+{
+    // 连接表只能在ioLoop线程里遍历，迁移的目标在这里先定好：池里剩下的loop，没有了就是baseLoop
+    std::vector<LoopContext*> targets;
+    if (migrate)
+    {
+        for (EventLoop *target : threadPool_->getAllLoops())
+        {
+            targets.push_back(contextFor(target));
+        }
+    }
+    for (LoopContext *target : targets)
+    {
+        // 先占一个连接数，drainConnectionsInLoop执行之前目标被drain掉也不会被销毁，执行完还回去
+        target->loop->connectionCountAdd(1);
+    }
+    ioLoop->runInLoop(std::bind(&TcpServer::drainConnectionsInLoop, this, contextFor(ioLoop), targets, migrate));
+}
+
+void TcpServer::drainConnectionsInLoop(LoopContext *ctx, const std::vector<LoopContext*> &targets, bool migrate)
+{
+    // 迁移会修改连接表，先拷出来
+    std::vector<TcpConnectionPtr> conns;
+    conns.reserve(ctx->connections.size());
+    for (auto &item : ctx->connections)
+    {
+        conns.push_back(item.second);
+    }
+    size_t next = 0;
+    for (const TcpConnectionPtr &conn : conns)
+    {
+        if (migrate)
+        {
+            // 在剩下的loop之间轮流分配
+            LoopContext *to = targets[next++ % targets.size()];
+            to->loop->connectionCountAdd(1);
+            migrateConnection(ctx, to, conn);
+        }
+        else
+        {
+            conn->shutdown();
+        }
+    }
+    for (LoopContext *target : targets)
+    {
+        target->loop->connectionCountAdd(-1);
+    }
+}
+
+void TcpServer::retireDrainedLoops()
+{
+    for (auto it = drainingLoops_.begin(); it != drainingLoops_.end(); )
+    {
+        EventLoop *ioLoop = it->loop;
+        // 迁移的目标在决定迁移时就预留了连接数，连接表里有条目的时候计数也不会是0
+        if (ioLoop->activeConnections() == 0 && contextFor(ioLoop)->numConnections == 0)
+        {
+            LOG_INFO("TcpServer::retireDrainedLoops [%s] - loop %p \n", name_.c_str(), ioLoop);
+            contexts_.erase(ioLoop); // 时间轮析构时要到loop上取消定时器，先于loop销毁
+            it = drainingLoops_.erase(it); // EventLoopThread析构：quit，执行完已经排队的回调，join
+        }
+        else
+        {
+            // drainLoop之前已经选中这个loop的rebalance/迁移可能在排空之后才把连接搬进来，再排空一次
+            drainConnections(ioLoop, it->migrate);
+            ++it;
+        }
+    }
+    if (!drainingLoops_.empty())
+    {
+        retireTimer_ = loop_->runAfter(kRetireCheckInterval, std::bind(&TcpServer::retireDrainedLoops, this));
     }
 }
 
 // 有一个新的客户端的连接，acceptor会执行这个回调操作
 void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
 {
-    // 轮询算法，选择一个subLoop，来管理channel
-    EventLoop *ioLoop = threadPool_->getNextLoop(); 
-    char buf[64] = {0};
-    snprintf(buf, sizeof buf, "-%s#%d", ipPort_.c_str(), nextConnId_);
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+    // 按负载均衡策略（默认轮询）选择一个subLoop，来管理channel
+    EventLoop *ioLoop = threadPool_->selectLoop(peerAddr);
+    // baseLoop只负责把fd交出去，连接对象在subLoop里面创建
+    // 先替它占一个连接数，不然连接创建出来之前，一批accept按负载都会选到同一个loop上
+    ioLoop->connectionCountAdd(1);
+    ioLoop->runInLoop(std::bind(&TcpServer::createReservedConnection, this, contextFor(ioLoop), sockfd, peerAddr));
+}
+
+void TcpServer::createReservedConnection(LoopContext *ctx, int sockfd, const InetAddress &peerAddr)
+{
+    ctx->loop->connectionCountAdd(-1); // TcpConnection构造的时候会重新计上
+    createConnection(ctx, sockfd, peerAddr);
+}
+
+void TcpServer::createConnection(LoopContext *ctx, int sockfd, const InetAddress &peerAddr)
+{
+    EventLoop *ioLoop = ctx->loop;
+    int64_t connId = ctx->pool->reserve();
 
-    LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s \n",
-        name_.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
+    LOG_INFO("TcpServer::newConnection [%s] - new connection [%s#%lld] from %s \n",
+        name_.c_str(), connNamePrefix_->c_str(), (long long)connId, peerAddr.toIpPort().c_str());
 
     // 通过sockfd获取其绑定的本机的ip地址和端口信息
     sockaddr_in local;
@@ -87,41 +392,168 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
     }
     InetAddress localAddr(local);
 
-    // 根据连接成功的sockfd，创建TcpConnection连接对象
-    TcpConnectionPtr conn(new TcpConnection(
+    // 根据连接成功的sockfd，创建TcpConnection连接对象  和引用计数一起放在reserve好的块里
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(
+                            ConnectionAllocator<TcpConnection>(ctx->pool, connId),
                             ioLoop,
-                            connName,
+                            connNamePrefix_,
+                            connId,
                             sockfd,   // Socket Channel
                             localAddr,
-                            peerAddr));
-    connections_[connName] = conn;
+                            peerAddr);
+    ctx->connections[connId] = conn;
+    ctx->numConnections = static_cast<int>(ctx->connections.size());
     // 下面的回调都是用户设置给TcpServer=>TcpConnection=>Channel=>Poller=>notify channel调用回调
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setEdgeTriggered(edgeTriggered_);
+    if (socketBusyPollUs_ > 0)
+    {
+        conn->setSocketBusyPoll(socketBusyPollUs_);
+    }
+    conn->setIdleTimingWheel(ctx->idleWheel);
 
-    // 设置了如何关闭连接的回调   conn->shutDown()
+    // 设置了如何关闭连接的回调   conn->shutDown()  迁移的时候换成新loop的ctx
     conn->setCloseCallback(
-        std::bind(&TcpServer::removeConnection, this, std::placeholders::_1)
+        std::bind(&TcpServer::removeConnection, this, ctx, std::placeholders::_1)
     );
 
     // 直接调用TcpConnection::connectEstablished
     ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
 }
 
-void TcpServer::removeConnection(const TcpConnectionPtr &conn)
+void TcpServer::rebalance()
+{
+    std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+    if (loops.size() < 2)
+    {
+        return;
+    }
+
+    // 最忙的loop：每轮耗时最高   最闲的loop：每轮耗时最低，相同时连接少的优先
+    EventLoop *hot = loops[0];
+    EventLoop *cool = loops[0];
+    for (EventLoop *ioLoop : loops)
+    {
+        if (ioLoop->iterationLatencyUs() > hot->iterationLatencyUs())
+        {
+            hot = ioLoop;
+        }
+        if (ioLoop->iterationLatencyUs() < cool->iterationLatencyUs()
+            || (ioLoop->iterationLatencyUs() == cool->iterationLatencyUs()
+                && ioLoop->activeConnections() < cool->activeConnections()))
+        {
+            cool = ioLoop;
+        }
+    }
+    if (hot == cool || hot->iterationLatencyUs() < rebalanceThresholdUs_ || hot->activeConnections() <= 1)
+    {
+        return;
+    }
+    if (cool->iterationLatencyUs() >= rebalanceThresholdUs_)
+    {
+        return; // 所有loop都超过阈值，搬过去也只是来回倒腾
+    }
+
+    // 搬走两边连接数差的一半，至少搬一个（连接数一样多但是有几个特别重的连接）
+    int toMove = std::max((hot->activeConnections() - cool->activeConnections()) / 2, 1);
+    LOG_INFO("TcpServer::rebalance [%s] - move %d connections, latency %ldus -> %ldus \n",
+        name_.c_str(), toMove, (long)hot->iterationLatencyUs(), (long)cool->iterationLatencyUs());
+
+    // 在cool上先预留toMove个连接数，迁移执行之前cool被drain掉也不会被销毁，没用上的在migrateConnectionsInLoop里还回去
+    cool->connectionCountAdd(toMove);
+    hot->runInLoop(std::bind(&TcpServer::migrateConnectionsInLoop, this, contextFor(hot), contextFor(cool), toMove));
+}
+
+void TcpServer::migrateConnectionsInLoop(LoopContext *from, LoopContext *to, int count)
+{
+    std::vector<TcpConnectionPtr> conns;
+    for (auto &item : from->connections)
+    {
+        if (static_cast<int>(conns.size()) >= count)
+        {
+            break;
+        }
+        if (item.second->connected())
+        {
+            conns.push_back(item.second);
+        }
+    }
+    for (const TcpConnectionPtr &conn : conns)
+    {
+        migrateConnection(from, to, conn);
+    }
+    to->loop->connectionCountAdd(static_cast<int>(conns.size()) - count);
+}
+
+void TcpServer::migrateConnection(LoopContext *from, LoopContext *to, const TcpConnectionPtr &conn)
+{
+    // 上一次迁移已经把它搬走了，等它到了新loop再说
+    if (conn->getLoop() != from->loop || from == to)
+    {
+        to->loop->connectionCountAdd(-1);
+        return;
+    }
+    // to上预留的连接数交给migrateTo，迁移完成或者放弃之前to不会被销毁
+    // 连接表和关闭回调在连接真正迁出的时候才换，迁移被拒绝（正在关闭、pin住以后被取消）时条目还留在from上
+    conn->migrateTo(to->loop, to->idleWheel,
+        std::bind(&TcpServer::connectionMigrated, this, from, to, std::placeholders::_1));
+}
+
+void TcpServer::connectionMigrated(LoopContext *from, LoopContext *to, const TcpConnectionPtr &conn)
+{
+    from->connections.erase(conn->id());
+    from->numConnections = static_cast<int>(from->connections.size());
+    conn->setCloseCallback(
+        std::bind(&TcpServer::removeConnection, this, to, std::placeholders::_1)
+    );
+    // 先排在to上登记，连接随后才排迁入：迁入to以后才会关闭，那时条目一定已经在to的连接表里了
+    to->loop->queueInLoop([to, conn]() {
+        to->connections[conn->id()] = conn;
+        to->numConnections = static_cast<int>(to->connections.size());
+    });
+}
+
+int TcpServer::numConnections() const
+{
+    int n = 0;
+    for (auto &item : contexts_)
+    {
+        n += item.second->numConnections;
+    }
+    return n;
+}
+
+void TcpServer::forEachConnection(const ConnectionCallback &cb)
+{
+    for (auto &item : contexts_)
+    {
+        LoopContext *ctx = item.second.get();
+        ctx->loop->runInLoop([ctx, cb]() {
+            for (auto &conn : ctx->connections)
+            {
+                cb(conn.second);
+            }
+        });
+    }
+}
+
+void TcpServer::removeConnection(LoopContext *ctx, const TcpConnectionPtr &conn)
 {
-    loop_->runInLoop(
-        std::bind(&TcpServer::removeConnectionInLoop, this, conn)
+    // 关闭回调跟着连接一起迁移，这里就在ctx的loop线程里
+    ctx->loop->runInLoop(
+        std::bind(&TcpServer::removeConnectionInLoop, this, ctx, conn)
     );
 }
 
-void TcpServer::removeConnectionInLoop(const TcpConnectionPtr &conn)
+void TcpServer::removeConnectionInLoop(LoopContext *ctx, const TcpConnectionPtr &conn)
 {
-    LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s\n", 
-        name_.c_str(), conn->name().c_str());
+    LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s#%lld\n", 
+        name_.c_str(), connNamePrefix_->c_str(), (long long)conn->id());
 
-    connections_.erase(conn->name());
+    ctx->connections.erase(conn->id());
+    ctx->numConnections = static_cast<int>(ctx->connections.size());
     EventLoop *ioLoop = conn->getLoop(); 
     ioLoop->queueInLoop(
         std::bind(&TcpConnection::connectDestroyed, conn)
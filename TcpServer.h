@@ -11,12 +11,14 @@
 #include "Callbacks.h"
 #include "TcpConnection.h"
 #include "Buffer.h"
+#include "ConnectionPool.h"
 
 #include <functional>
 #include <string>
 #include <memory>
 #include <atomic>
 #include <unordered_map>
+#include <vector>
 
 // 对外的服务器编程使用的类
 class TcpServer : noncopyable
@@ -30,6 +32,14 @@ public:
         kReusePort,
     };
 
+    // 谁来accept新连接
+    enum AcceptMode
+    {
+        kBaseLoopAccept,           // baseLoop上一个Acceptor，选好subloop以后分发过去，默认
+        kShardedAccept,            // 每个subloop一个SO_REUSEPORT的Acceptor，内核按四元组哈希分发，accept、建连和读写都在同一个loop上
+        kShardedAcceptCpuSteering, // 同上，再挂一个CBPF程序，新连接交给绑定在收到它的cpu上的那个loop，需要设置绑核策略
+    };
+
     TcpServer(EventLoop *loop,
                 const InetAddress &listenAddr,
                 const std::string &nameArg,
@@ -43,22 +53,99 @@ public:
 
     // 设置底层subloop的个数
     void setThreadNum(int numThreads);
+    // 设置accept的方式，需要在start之前调用
+    void setAcceptMode(AcceptMode mode) { acceptMode_ = mode; }
+    // 设置新连接选择subloop的策略，默认轮询，只对kBaseLoopAccept有效
+    void setLoadBalance(EventLoopThreadPool::LoadBalance strategy) { threadPool_->setLoadBalance(strategy); }
+    // 设置subloop线程的cpu绑定策略，需要在start之前调用
+    void setThreadAffinity(EventLoopThreadPool::AffinityPolicy policy, const std::vector<int> &cpus = std::vector<int>())
+    { threadPool_->setAffinity(policy, cpus); }
+    // 设置空闲连接的超时时间，超过seconds秒没有收到数据的连接会被关闭，<=0表示不检测，需要在start之前调用
+    void setIdleTimeout(int seconds) { idleTimeoutSeconds_ = seconds; }
+    // 新连接使用epoll的ET模式，读写一直到EAGAIN（带公平性预算），需要在start之前调用
+    void setEdgeTriggered(bool on) { edgeTriggered_ = on; }
+    // 给新连接的socket设置SO_BUSY_POLL，<=0表示不设置
+    void setSocketBusyPoll(int usec) { socketBusyPollUs_ = usec; }
+    /**
+     * 后台再平衡：每隔intervalSeconds秒检查一次各个subloop，每轮循环耗时超过thresholdUs微秒的最忙loop
+     * 会把一部分连接迁移到最闲的loop上  intervalSeconds<=0表示关闭，需要在start之前调用
+     */ 
+    void setRebalance(double intervalSeconds, int64_t thresholdUs)
+    { rebalanceInterval_ = intervalSeconds; rebalanceThresholdUs_ = thresholdUs; }
 
     // 开启服务器监听
     void start();
+
+    /**
+     * 运行时调整subloop，start之后在baseLoop线程中调用
+     * addLoop: 增加一个subloop，之后的新连接按负载均衡策略也会分配到它上面
+     * drainLoop: 不再给ioLoop分配新连接，上面已有的连接migrate为true时迁移到其它loop上，
+     *            否则shutdown优雅关闭，等连接全部离开以后loop线程退出
+     */ 
+    EventLoop* addLoop();
+    void drainLoop(EventLoop *ioLoop, bool migrate);
+
+    /**
+     * 连接保存在各个loop自己的连接表里，需要全局视图的时候才汇总，在baseLoop线程中调用
+     * numConnections: 当前所有loop上的连接数之和
+     * forEachConnection: 在每个连接所属的loop线程里对它执行cb，异步执行，调用返回时不一定已经执行完
+     */ 
+    int numConnections() const;
+    void forEachConnection(const ConnectionCallback &cb);
 private:
-    void newConnection(int sockfd, const InetAddress &peerAddr);
-    void removeConnection(const TcpConnectionPtr &conn);
-    void removeConnectionInLoop(const TcpConnectionPtr &conn);
+    // 每个loop一份，连接的建立、关闭和迁移都在所属loop的线程里更新自己的连接表，不用经过baseLoop
+    struct LoopContext
+    {
+        explicit LoopContext(EventLoop *ioLoop) : loop(ioLoop), numConnections(0) {}
+
+        EventLoop *loop;
+        std::shared_ptr<ConnectionPool> pool; // 在这个loop上建立的连接从这里分配
+        std::shared_ptr<TimingWheel> idleWheel; // 为空表示不检测空闲连接
+        std::unordered_map<int64_t, TcpConnectionPtr> connections; // 只在loop线程中访问
+        std::atomic_int numConnections; // connections的大小，给其它线程读
+    };
 
-    using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
+    void newConnection(int sockfd, const InetAddress &peerAddr);
+    // 在ctx的loop线程里创建连接
+    void createConnection(LoopContext *ctx, int sockfd, const InetAddress &peerAddr);
+    void createReservedConnection(LoopContext *ctx, int sockfd, const InetAddress &peerAddr);
+    void addShardAcceptor(LoopContext *ctx);
+    void removeShardAcceptor(EventLoop *ioLoop);
+    void updateCpuSteering();
+    void removeConnection(LoopContext *ctx, const TcpConnectionPtr &conn);
+    void removeConnectionInLoop(LoopContext *ctx, const TcpConnectionPtr &conn);
+    // 在from的loop线程里执行，把from上的连接迁移出去，连接表的条目跟着连接走  调用方先在to上预留一个连接数
+    void migrateConnection(LoopContext *from, LoopContext *to, const TcpConnectionPtr &conn);
+    // 连接真正迁出之前在from的loop线程里调用
+    void connectionMigrated(LoopContext *from, LoopContext *to, const TcpConnectionPtr &conn);
+    void migrateConnectionsInLoop(LoopContext *from, LoopContext *to, int count);
+    // 在baseLoop线程里定好迁移目标，再到ioLoop上排空它的连接表
+    void drainConnections(EventLoop *ioLoop, bool migrate);
+    void drainConnectionsInLoop(LoopContext *ctx, const std::vector<LoopContext*> &targets, bool migrate);
+    void destroyConnectionsInLoop(LoopContext *ctx);
+    void rebalance(); // 在baseLoop上定时执行
+    void retireDrainedLoops(); // 在baseLoop上定时检查，销毁连接已经全部离开的loop
+    LoopContext* contextFor(EventLoop *ioLoop); // 没有就创建，只在baseLoop线程中调用
+
+    using LoopContextMap = std::unordered_map<EventLoop*, std::unique_ptr<LoopContext>>;
+    struct DrainingLoop
+    {
+        EventLoop *loop;
+        std::unique_ptr<EventLoopThread> thread;
+        bool migrate;
+    };
+    using DrainingLoopList = std::vector<DrainingLoop>;
+    using ShardAcceptorList = std::vector<std::pair<EventLoop*, std::shared_ptr<Acceptor>>>;
 
     EventLoop *loop_; // baseLoop 用户定义的loop
 
+    const InetAddress listenAddr_;
     const std::string ipPort_;
     const std::string name_;
 
-    std::unique_ptr<Acceptor> acceptor_; // 运行在mainLoop，任务就是监听新连接事件
+    std::unique_ptr<Acceptor> acceptor_; // 运行在mainLoop，任务就是监听新连接事件   分片accept时不用
+    AcceptMode acceptMode_;
+    ShardAcceptorList shardAcceptors_; // 分片accept时每个subloop的Acceptor，和内核reuseport组里的顺序一致，只在baseLoop线程中修改
 
     std::shared_ptr<EventLoopThreadPool> threadPool_; // one loop per thread
 
@@ -70,6 +157,19 @@ private:
 
     std::atomic_int started_;
 
-    int nextConnId_;
-    ConnectionMap connections_; // 保存所有的连接
+    std::shared_ptr<const std::string> connNamePrefix_; // name-ip:port，和连接id拼成连接的名字
+    LoopContextMap contexts_; // 只在baseLoop线程中修改，连接创建以后直接拿着自己loop的LoopContext指针
+    // 按编号记录各个ConnectionPool，过期了编号才能复用：loop销毁以后它的连接可能还迁移在别的loop上
+    std::vector<std::weak_ptr<ConnectionPool>> pools_;
+
+    int idleTimeoutSeconds_;
+    int socketBusyPollUs_;
+    bool edgeTriggered_;
+
+    double rebalanceInterval_;
+    int64_t rebalanceThresholdUs_;
+    TimerId rebalanceTimer_;
+
+    DrainingLoopList drainingLoops_; // 正在排空的loop，连接都离开以后销毁
+    TimerId retireTimer_;
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+class Timer;
+
+// 提供给用户取消定时器的句柄，不管理Timer的生命周期
+class TimerId
+{
+public:
+    TimerId()
+        : timer_(nullptr)
+        , sequence_(0)
+    {}
+
+    TimerId(Timer *timer, int64_t seq)
+        : timer_(timer)
+        , sequence_(seq)
+    {}
+
+    friend class TimerQueue;
+private:
+    Timer *timer_;
+    int64_t sequence_;
+};
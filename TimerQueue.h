@@ -0,0 +1,55 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+#include "Callbacks.h"
+#include "Channel.h"
+
+#include <set>
+#include <vector>
+
+class EventLoop;
+class Timer;
+class TimerId;
+
+/**
+ * 每个EventLoop持有一个TimerQueue，所有定时器共用一个timerfd，timerfd注册成Channel交给Poller监听
+ * timerfd总是设置成最早到期的那个定时器的超时时间，一次唤醒批量处理所有已到期的定时器
+ * 定时器按(到期时间, Timer*)保存在std::set里面，插入删除都是O(logn)
+ */ 
+class TimerQueue : noncopyable
+{
+public:
+    explicit TimerQueue(EventLoop *loop);
+    ~TimerQueue();
+
+    // 线程安全，可以在其它线程中调用
+    TimerId addTimer(TimerCallback cb, Timestamp when, double interval);
+    void cancel(TimerId timerId);
+private:
+    using Entry = std::pair<Timestamp, Timer*>;
+    using TimerList = std::set<Entry>;
+    using ActiveTimer = std::pair<Timer*, int64_t>;
+    using ActiveTimerSet = std::set<ActiveTimer>;
+
+    void addTimerInLoop(Timer *timer);
+    void cancelInLoop(TimerId timerId);
+    // timerfd可读，说明有定时器到期了
+    void handleRead();
+    // 取出所有已到期的定时器
+    std::vector<Entry> getExpired(Timestamp now);
+    // 重复定时器重新插入，一次性定时器释放掉
+    void reset(const std::vector<Entry> &expired, Timestamp now);
+    // 返回新插入的定时器是否成为了最早到期的定时器
+    bool insert(Timer *timer);
+
+    EventLoop *loop_;
+    const int timerfd_;
+    Channel timerfdChannel_;
+
+    TimerList timers_; // 按到期时间排序的定时器
+    ActiveTimerSet activeTimers_; // 和timers_保存相同的定时器，按Timer地址排序，用于cancel
+
+    bool callingExpiredTimers_; // 正在执行到期定时器的回调
+    ActiveTimerSet cancelingTimers_; // 回调执行过程中被取消的定时器，不能再重新插入
+};
@@ -0,0 +1,90 @@
+#include "TimingWheel.h"
+#include "EventLoop.h"
+
+TimingWheel::TimingWheel(EventLoop *loop, int timeoutSeconds)
+    : loop_(loop)
+    , timeoutSeconds_(timeoutSeconds)
+    , buckets_(timeoutSeconds + 2)
+    , tick_(0)
+{
+    for (Entry &head : buckets_)
+    {
+        head.prev = head.next = &head;
+    }
+}
+
+TimingWheel::~TimingWheel()
+{
+    // 时间轮随着drain/退役的loop一起销毁，不取消的话这个每秒一次的定时器会一直留在loop上   cancel是线程安全的
+    loop_->cancel(timerId_);
+}
+
+void TimingWheel::start()
+{
+    // 定时器只持有weak_ptr，时间轮析构以后tick直接忽略
+    std::weak_ptr<TimingWheel> weakWheel(shared_from_this());
+    timerId_ = loop_->runEvery(1.0, [weakWheel]() {
+        std::shared_ptr<TimingWheel> wheel = weakWheel.lock();
+        if (wheel)
+        {
+            wheel->onTick();
+        }
+    });
+}
+
+void TimingWheel::refresh(Entry *entry)
+{
+    // 放在tick_+timeout+1的格子上，保证至少经过timeout秒才会超时
+    int bucket = (tick_ + timeoutSeconds_ + 1) % static_cast<int>(buckets_.size());
+    if (entry->bucket == bucket)
+    {
+        return; // 同一秒内多次刷新，什么都不用做
+    }
+    if (entry->linked())
+    {
+        unlink(entry);
+    }
+    link(entry, bucket);
+}
+
+void TimingWheel::remove(Entry *entry)
+{
+    if (entry->linked())
+    {
+        unlink(entry);
+    }
+}
+
+void TimingWheel::onTick()
+{
+    tick_ = (tick_ + 1) % static_cast<int>(buckets_.size());
+    Entry &head = buckets_[tick_];
+    // 回调里面可能会remove同一个格子上的其它entry，所以每次都从链表头取
+    while (head.next != &head)
+    {
+        Entry *entry = head.next;
+        unlink(entry);
+        if (entry->expireCallback)
+        {
+            entry->expireCallback();
+        }
+    }
+}
+
+void TimingWheel::link(Entry *entry, int bucket)
+{
+    Entry &head = buckets_[bucket];
+    entry->prev = head.prev;
+    entry->next = &head;
+    head.prev->next = entry;
+    head.prev = entry;
+    entry->bucket = bucket;
+}
+
+void TimingWheel::unlink(Entry *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = nullptr;
+    entry->bucket = -1;
+}
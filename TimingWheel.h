@@ -0,0 +1,59 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "TimerId.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+class EventLoop;
+
+/**
+ * 时间轮，用于踢掉长时间没有活动的连接   每个loop一个，只能在所属loop的线程中使用
+ * 每秒走一格，每一格是一个侵入式双向链表，链表节点Entry嵌在被管理的对象（TcpConnection）里面
+ * add/refresh/remove都是O(1)的链表操作，并且不分配任何内存
+ */ 
+class TimingWheel : noncopyable, public std::enable_shared_from_this<TimingWheel>
+{
+public:
+    using ExpireCallback = std::function<void()>;
+
+    struct Entry
+    {
+        Entry() : prev(nullptr), next(nullptr), bucket(-1) {}
+
+        bool linked() const { return bucket >= 0; }
+
+        Entry *prev;
+        Entry *next;
+        int bucket; // 所在的格子，-1表示不在时间轮上
+        ExpireCallback expireCallback; // 超时的回调，在add之前设置好
+    };
+
+    // 超时时间在[timeoutSeconds, timeoutSeconds+1)秒之间
+    TimingWheel(EventLoop *loop, int timeoutSeconds);
+    // 取消start时注册的定时器，所属的loop要比时间轮活得久
+    ~TimingWheel();
+
+    // 开始每秒走一格，需要在loop线程中调用
+    void start();
+
+    // 把entry放到当前时间之后timeoutSeconds秒的格子上
+    void add(Entry *entry) { refresh(entry); }
+    // 有活动了，把entry移动到最新的格子上
+    void refresh(Entry *entry);
+    void remove(Entry *entry);
+
+    int timeoutSeconds() const { return timeoutSeconds_; }
+private:
+    void onTick();
+    void link(Entry *entry, int bucket);
+    void unlink(Entry *entry);
+
+    EventLoop *loop_;
+    const int timeoutSeconds_;
+    std::vector<Entry> buckets_; // 每个格子的链表头（哨兵节点）
+    int tick_; // 当前指针指向的格子
+    TimerId timerId_;
+};
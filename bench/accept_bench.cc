@@ -0,0 +1,166 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/Timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * Acceptor的连接风暴测试，服务端的日志写在stdout，运行时重定向掉：./accept_bench > /dev/null
+ * churn: 多个客户端线程每轮一口气connect 64个连接再全部RST关掉，统计服务端每秒建立的连接数
+ * emfile: 把进程的fd上限调低，再发起远超上限的连接并保持住，统计这段时间服务端消耗的cpu
+ *         没有预留fd的时候listen fd一直可读，loop会空转
+ */
+static const int kClientThreads = 4;
+static const int kBurst = 64;
+static const int kRounds = 50;
+static const uint16_t kPort = 19527;
+
+static int connectTo(uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    InetAddress addr(port);
+    if (::connect(fd, (sockaddr*)addr.getSockAddr(), sizeof(sockaddr_in)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void closeWithReset(int fd)
+{
+    struct linger lg = { 1, 0 }; // 直接RST，不留TIME_WAIT
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+    ::close(fd);
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void churn()
+{
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "churn");
+    server.setThreadNum(2);
+    std::atomic<int> accepted(0);
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            ++accepted;
+        }
+    });
+    server.setMessageCallback([](const TcpConnectionPtr&, Buffer *buf, Timestamp) { buf->retrieveAll(); });
+    server.start();
+
+    const int total = kClientThreads * kBurst * kRounds;
+    Timestamp start(Timestamp::now());
+    std::thread driver([&]() {
+        std::vector<std::thread> clients;
+        for (int t = 0; t < kClientThreads; ++t)
+        {
+            clients.emplace_back([]() {
+                for (int r = 0; r < kRounds; ++r)
+                {
+                    int fds[kBurst];
+                    for (int i = 0; i < kBurst; ++i)
+                    {
+                        fds[i] = connectTo(kPort);
+                    }
+                    for (int i = 0; i < kBurst; ++i)
+                    {
+                        if (fds[i] >= 0)
+                        {
+                            closeWithReset(fds[i]);
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread &c : clients)
+        {
+            c.join();
+        }
+        // 在accept队列里就被RST掉的连接不一定会被accept到，数量不再增长就结束
+        int last = -1;
+        while (accepted.load() < total && accepted.load() != last)
+        {
+            last = accepted.load();
+            ::usleep(100 * 1000);
+        }
+        loop.runInLoop([&loop]() { loop.quit(); });
+    });
+    loop.loop();
+    driver.join();
+
+    double seconds = timeDifference(Timestamp::now(), start);
+    fprintf(stderr, "churn: %d/%d connections in %.3fs, %.0f conn/s\n",
+        accepted.load(), total, seconds, accepted.load() / seconds);
+}
+
+static void emfile()
+{
+    struct rlimit limit = { 64, 4096 };
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort + 1), "emfile");
+    std::atomic<int> accepted(0);
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            ++accepted;
+        }
+    });
+    server.setMessageCallback([](const TcpConnectionPtr&, Buffer *buf, Timestamp) { buf->retrieveAll(); });
+    server.start();
+
+    // 客户端的fd在另一个进程里，不占服务端的上限
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        struct rlimit unlimited = { 4096, 4096 };
+        ::setrlimit(RLIMIT_NOFILE, &unlimited);
+        int connected = 0;
+        for (int i = 0; i < 200; ++i)
+        {
+            connected += connectTo(kPort + 1) >= 0;
+        }
+        fprintf(stderr, "emfile: client connected %d\n", connected);
+        ::sleep(2);
+        _exit(0);
+    }
+
+    double cpuStart = 0;
+    loop.runAfter(0.5, [&]() { cpuStart = cpuSeconds(); });
+    loop.runAfter(1.5, [&]() {
+        fprintf(stderr, "emfile: accepted %d, server cpu %.3fs over 1s of fd exhaustion\n",
+            accepted.load(), cpuSeconds() - cpuStart);
+        loop.quit();
+    });
+    loop.loop();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "emfile") == 0)
+    {
+        emfile();
+    }
+    else
+    {
+        churn();
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <mymuduo/Buffer.h>
+#include <mymuduo/Timestamp.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+
+/**
+ * 发送缓冲区的流式测试：缓冲区里一直积压backlog字节，每次append一条消息，再retrieve掉同样长度（相当于writeFd发出去一部分）
+ * 连续模式下写到末尾以后每次makeSpace都要把整个积压的数据挪到前面，分段模式只追加、释放块
+ */
+static const size_t kMessage = 4096;
+static const double kSeconds = 1.0; // 每种情况跑这么久
+
+static double stream(bool segmented, size_t backlog)
+{
+    Buffer buf;
+    buf.setSegmented(segmented);
+    std::string message(kMessage, 'x');
+    std::string fill(backlog, 'y');
+    buf.append(fill.data(), fill.size());
+
+    Timestamp start(Timestamp::now());
+    size_t total = 0;
+    double seconds = 0;
+    while (seconds < kSeconds)
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            buf.append(message.data(), message.size());
+            buf.retrieve(kMessage);
+        }
+        total += 64 * kMessage;
+        seconds = timeDifference(Timestamp::now(), start);
+    }
+    return total / seconds / (1024 * 1024);
+}
+
+// 移动以后的Buffer要和新建的一样能用（operator=也是经过移动构造）
+static void checkMovedFrom(bool segmented)
+{
+    Buffer a;
+    a.setSegmented(segmented);
+    a.append("hello", 5);
+    Buffer b(std::move(a));
+    assert(b.retrieveAllAsString() == "hello");
+    assert(a.readableBytes() == 0);
+    a.append("x", 1);
+    assert(a.retrieveAllAsString() == "x");
+
+    Buffer c;
+    c.append("world", 5);
+    b = std::move(c);
+    assert(b.retrieveAllAsString() == "world");
+    assert(c.readableBytes() == 0);
+    c.append("y", 1);
+    assert(c.retrieveAllAsString() == "y");
+}
+
+int main()
+{
+    checkMovedFrom(false);
+    checkMovedFrom(true);
+
+    printf("%10s %14s %14s\n", "backlog", "contiguous", "segmented");
+    for (size_t backlog = 1024; backlog <= 16 * 1024 * 1024; backlog *= 4)
+    {
+        double contiguous = stream(false, backlog);
+        double segmented = stream(true, backlog);
+        printf("%9zuK %10.0f MB/s %10.0f MB/s\n", backlog / 1024, contiguous, segmented);
+    }
+    return 0;
+}
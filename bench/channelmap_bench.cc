@@ -0,0 +1,101 @@
+#include <mymuduo/Poller.h>
+#include <mymuduo/Channel.h>
+#include <mymuduo/Timestamp.h>
+
+#include <stdio.h>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Poller的ChannelMap在10万个channel下的update/remove churn测试
+ * 对比原来的unordered_map<int, Channel*>和Poller里按fd下标的vector<Channel*>（直接用Poller的findChannel/addChannelToMap/removeChannelFromMap）
+ * 每一轮：随机挑一个fd，update（查找并修改）几次，然后remove再重新add，模拟连接的interest变化和断开重连
+ * 只测查表，不调epoll_ctl，也没有日志，channel也不需要真的fd
+ */
+static const int kChannels = 100000;
+static const int kRounds = 5000000;
+
+class HashMap
+{
+public:
+    void add(Channel *ch) { channels_[ch->fd()] = ch; }
+    void remove(int fd) { channels_.erase(fd); }
+    Channel* find(int fd) const
+    {
+        auto it = channels_.find(fd);
+        return it != channels_.end() ? it->second : nullptr;
+    }
+private:
+    std::unordered_map<int, Channel*> channels_;
+};
+
+// 借Poller的ChannelMap，IO复用的接口都不用
+class DenseMap : public Poller
+{
+public:
+    DenseMap() : Poller(nullptr) {}
+
+    Timestamp poll(int, ChannelList*) override { return Timestamp(); }
+    void updateChannel(Channel*) override {}
+    void removeChannel(Channel*) override {}
+
+    void add(Channel *ch) { addChannelToMap(ch); }
+    void remove(int fd) { removeChannelFromMap(fd); }
+    Channel* find(int fd) const { return findChannel(fd); }
+};
+
+template <typename Map>
+double run(std::vector<std::unique_ptr<Channel>> &channels, const std::vector<int> &picks)
+{
+    Map map;
+    for (std::unique_ptr<Channel> &ch : channels)
+    {
+        map.add(ch.get());
+    }
+
+    Timestamp start(Timestamp::now());
+    long sum = 0;
+    for (int fd : picks)
+    {
+        // enableWriting / disableWriting / enableReading：每次都要按fd找到channel，改它在poller里的状态
+        for (int i = 0; i < 3; ++i)
+        {
+            Channel *ch = map.find(fd);
+            ch->set_index(ch->index() ^ 1);
+            sum += ch->index();
+        }
+        map.remove(fd);
+        map.add(channels[fd].get());
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    if (sum == 42)
+    {
+        printf("unreachable\n");
+    }
+    return seconds;
+}
+
+int main()
+{
+    std::vector<std::unique_ptr<Channel>> channels;
+    for (int fd = 0; fd < kChannels; ++fd)
+    {
+        channels.emplace_back(new Channel(nullptr, fd));
+    }
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<int> dist(0, kChannels - 1);
+    std::vector<int> picks(kRounds);
+    for (int &fd : picks)
+    {
+        fd = dist(rng);
+    }
+
+    double hashSec = run<HashMap>(channels, picks);
+    double denseSec = run<DenseMap>(channels, picks);
+    printf("%d channels, %d rounds (3 update + remove + add)\n", kChannels, kRounds);
+    printf("unordered_map       : %.1f ns/round\n", hashSec * 1e9 / kRounds);
+    printf("Poller::ChannelMap  : %.1f ns/round\n", denseSec * 1e9 / kRounds);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <mymuduo/MpscQueue.h>
+#include <mymuduo/Timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * EventLoop::queueInLoop的竞争测试：多个生产者线程往一个消费者投递Functor
+ * 对比原来的vector+mutex（消费者swap）和现在的无锁MpscQueue
+ */ 
+using Functor = std::function<void()>;
+
+static const int kPerProducer = 1000000;
+
+class MutexQueue
+{
+public:
+    void push(Functor cb)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        pending_.emplace_back(std::move(cb));
+    }
+    // 消费者一次取走全部
+    size_t drain()
+    {
+        std::vector<Functor> functors;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            functors.swap(pending_);
+        }
+        for (const Functor &f : functors)
+        {
+            f();
+        }
+        return functors.size();
+    }
+private:
+    std::mutex mutex_;
+    std::vector<Functor> pending_;
+};
+
+class LockFreeQueue
+{
+public:
+    void push(Functor cb) { queue_.push(std::move(cb)); }
+    size_t drain()
+    {
+        size_t n = 0;
+        Functor f;
+        while (queue_.pop(&f))
+        {
+            f();
+            ++n;
+        }
+        return n;
+    }
+private:
+    MpscQueue<Functor> queue_;
+};
+
+template <typename Queue>
+double run(int producers)
+{
+    Queue queue;
+    std::atomic<int64_t> executed(0);
+    const size_t total = static_cast<size_t>(producers) * kPerProducer;
+
+    Timestamp start(Timestamp::now());
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i)
+    {
+        threads.emplace_back([&queue, &executed]() {
+            for (int j = 0; j < kPerProducer; ++j)
+            {
+                queue.push([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+
+    size_t consumed = 0;
+    while (consumed < total)
+    {
+        consumed += queue.drain();
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    return timeDifference(Timestamp::now(), start);
+}
+
+int main(int argc, char *argv[])
+{
+    int maxProducers = argc > 1 ? atoi(argv[1]) : 8;
+    printf("%-10s %-16s %-16s\n", "producers", "mutex(Mops/s)", "mpsc(Mops/s)");
+    for (int producers = 1; producers <= maxProducers; producers *= 2)
+    {
+        double total = static_cast<double>(producers) * kPerProducer / 1e6;
+        double mutexSec = run<MutexQueue>(producers);
+        double mpscSec = run<LockFreeQueue>(producers);
+        printf("%-10d %-16.2f %-16.2f\n", producers, total / mutexSec, total / mpscSec);
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/Timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * 缓存好的大响应发给很多连接：客户端每发一个字节，服务端回一个header加1M的body
+ * copy:  conn->send(std::string)，发不完的部分拷贝到每个连接的outputBuffer里
+ * slice: conn->send({header, body})，header和body是所有连接共享的，只增加引用计数
+ * 客户端在fork出来的子进程里，统计服务端进程的cpu时间  运行：./send_bench copy|slice > /dev/null
+ */
+static const int kClients = 16;
+static const int kRequests = 64;
+static const size_t kBodySize = 1024 * 1024;
+static const uint16_t kPort = 19528;
+
+static long maxRssKb()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void runClients(size_t responseSize)
+{
+    std::vector<std::thread> clients;
+    for (int i = 0; i < kClients; ++i)
+    {
+        clients.emplace_back([responseSize]() {
+            int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            InetAddress addr(kPort);
+            if (::connect(fd, (sockaddr*)addr.getSockAddr(), sizeof(sockaddr_in)) < 0)
+            {
+                ::close(fd);
+                return;
+            }
+            char buf[65536];
+            for (int r = 0; r < kRequests; ++r)
+            {
+                if (::write(fd, "r", 1) != 1)
+                {
+                    break;
+                }
+                size_t got = 0;
+                while (got < responseSize)
+                {
+                    ssize_t n = ::read(fd, buf, sizeof buf);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+                    got += n;
+                }
+            }
+            ::close(fd);
+        });
+    }
+    for (std::thread &c : clients)
+    {
+        c.join();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const bool useSlices = argc > 1 && strcmp(argv[1], "slice") == 0;
+
+    Buffer::Slice header(std::make_shared<std::string>("HTTP/1.1 200 OK\r\nContent-Length: 1048576\r\n\r\n"));
+    Buffer::Slice body(std::make_shared<std::string>(kBodySize, 'b'));
+    const std::string response = *header + *body;
+    const std::vector<Buffer::Slice> slices = { header, body };
+
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "send");
+    server.setThreadNum(2);
+    server.setConnectionCallback([](const TcpConnectionPtr&) {});
+    server.setMessageCallback([&](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        for (size_t i = 0; i < buf->readableBytes(); ++i)
+        {
+            if (useSlices)
+            {
+                conn->send(slices);
+            }
+            else
+            {
+                conn->send(response);
+            }
+        }
+        buf->retrieveAll();
+    });
+    server.start();
+
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        ::usleep(100 * 1000);
+        runClients(response.size());
+        _exit(0);
+    }
+
+    double cpuStart = cpuSeconds();
+    Timestamp start(Timestamp::now());
+    std::thread waiter([&]() {
+        ::waitpid(pid, nullptr, 0);
+        loop.runInLoop([&loop]() { loop.quit(); });
+    });
+    loop.loop();
+    waiter.join();
+
+    double seconds = timeDifference(Timestamp::now(), start);
+    double total = static_cast<double>(response.size()) * kClients * kRequests / (1024 * 1024);
+    fprintf(stderr, "%s: %.0f MB in %.3fs, %.0f MB/s, server cpu %.3fs, max rss %ld KB\n",
+        useSlices ? "slice" : "copy", total, seconds, total / seconds, cpuSeconds() - cpuStart, maxRssKb());
+    return 0;
+}